@@ -1,16 +1,28 @@
 #include "framework.h"
+#include "PoincareGenerator.h"
+#include "PerformanceHud.h"
+#include "FrameScheduler.h"
+#include "FrameCapture.h"
+#include "VirtualTexture.h"
+#include <cstdarg>
+#include <list>
+#include <random>
 
 /**
  * @brief Vertex shader in GLSL.
  *
  * @details This shader takes in vertex positions and UV coordinates, and outputs texture coordinates.
- * It also transforms the vertex positions to clipping space using the Model-View-Projection (MVP) matrix.
+ * It also transforms the vertex positions to clipping space with the model matrix of the star and the
+ * View-Projection matrix of the camera, which comes from the per-frame uniform buffer (see FrameData).
  */
 const char *vertexSource = R"(
     #version 330
     precision highp float;
 
-    uniform mat4 MVP;           ///< Model-View-Projection matrix in row-major format
+    layout(std140, row_major) uniform FrameData {
+        mat4 VP;                ///< View-Projection matrix of the camera, set once per frame
+    };
+    uniform mat4 M;             ///< Model matrix in row-major format
 
     layout(location = 0) in vec2 vertexPosition;    ///< Attrib Array 0
     layout(location = 1) in vec2 vertexUV;          ///< Attrib Array 1
@@ -19,7 +31,48 @@ const char *vertexSource = R"(
 
     void main() {
         texCoord = vertexUV;                        ///< copy texture coordinates
-        gl_Position = vec4(vertexPosition.x, vertexPosition.y, 0, 1) * MVP;  ///< transform to clipping space
+        gl_Position = vec4(vertexPosition.x, vertexPosition.y, 0, 1) * M * VP;  ///< transform to clipping space
+    }
+)";
+
+/**
+ * @brief Vertex shader in GLSL for the star field.
+ *
+ * @details Every instance is a copy of the star with its own centre, animation phase and thinness. The animation of
+ * Star::Animate and Star::M is evaluated here from the time uniform, so the CPU only sets one float per frame.
+ */
+const char *starFieldVertexSource = R"(
+    #version 330
+    precision highp float;
+
+    layout(std140, row_major) uniform FrameData {
+        mat4 VP;                ///< View-Projection matrix of the camera, set once per frame
+    };
+    uniform float time;         ///< animation time in seconds
+    uniform float starScale;    ///< size of an instance relative to the single star
+    uniform vec2 starCenter;    ///< centre of the self rotation of the star
+    uniform vec2 circleCenter;  ///< centre of the orbit of the star
+
+    layout(location = 0) in vec2 vertexPosition;    ///< Attrib Array 0
+    layout(location = 1) in vec2 vertexUV;          ///< Attrib Array 1
+    layout(location = 2) in vec4 instance;          ///< per instance: centre, phase and thinness
+
+    out vec2 texCoord;                              ///< output attribute
+
+    vec2 rotate(vec2 p, vec2 center, float angle) {
+        float c = cos(angle), s = sin(angle);
+        p -= center;
+        return vec2(p.x * c - p.y * s, p.x * s + p.y * c) + center;
+    }
+
+    void main() {
+        texCoord = vertexUV;
+        vec2 inward = 1 - 2 * vertexUV;             ///< the four inner vertices move towards the centre
+        if (inward.x * inward.y != 0) inward = vec2(0);
+        float angle = time * 2 * 3.14159265 / 10 + instance.z;
+        vec2 p = rotate(vertexPosition + instance.w * inward, starCenter, angle);
+        p = rotate(p, circleCenter, angle);
+        gl_Position = vec4((p - starCenter) * starScale + instance.xy, 0, 1) * VP;
     }
 )";
 
@@ -27,83 +80,1433 @@ const char *vertexSource = R"(
  * @brief Fragment shader in GLSL.
  *
  * @details This shader takes in interpolated texture coordinates and fetches the corresponding color from the texture.
+ * In palette mode the texture holds texel classes, which are looked up in a small palette of colours. In distance
+ * mode it holds the signed distances of PoincareGenerator::renderDistanceRows, whose zero crossings are the edges.
  */
 const char *fragmentSource = R"(
     #version 330
     precision highp float;
 
-    uniform sampler2D textureUnit; ///< Texture unit
+    uniform sampler2D textureUnit; ///< Texture unit
+    uniform bool paletteMode;      ///< the texture holds texel classes instead of colours
+    uniform bool paletteLinear;    ///< interpolate the palette colours bilinearly
+    uniform vec4 palette[3];       ///< colours of the texel classes
+    uniform bool distanceMode;     ///< the texture holds signed distances to the edges instead of colours
+    uniform float distanceRange;   ///< the distance in texels of the ends of a distance channel
+
+    in vec2 texCoord;              ///< variable input: interpolated texture coordinates
+    out vec4 fragmentColor;        ///< output that goes to the raster memory as told by glBindFragDataLocation
+
+    vec4 paletteColor(ivec2 texel) {
+        texel = clamp(texel, ivec2(0), textureSize(textureUnit, 0) - 1);
+        return palette[int(texelFetch(textureUnit, texel, 0).r * 255.0 + 0.5)];
+    }
+
+    void main() {
+        if (distanceMode) {                             ///< sharp edges at any zoom, anti-aliased over one pixel
+            vec2 field = texture(textureUnit, texCoord).rg * 255.0;
+            vec2 texels = (field - 128.0) / 127.0 * distanceRange;  ///< x: odd parity, y: inside the disk
+            vec2 coverage = clamp(texels / max(fwidth(texels), vec2(1e-4)) + 0.5, 0.0, 1.0);
+            fragmentColor = mix(palette[0], mix(palette[1], palette[2], coverage.x), coverage.y);
+            return;
+        }
+        if (!paletteMode) {
+            fragmentColor = texture(textureUnit, texCoord); ///< fetch color from texture
+            return;
+        }
+        vec2 st = texCoord * vec2(textureSize(textureUnit, 0));
+        if (!paletteLinear) {
+            fragmentColor = paletteColor(ivec2(floor(st)));
+            return;
+        }
+        st -= 0.5;                                      ///< filter the colours, class indices do not interpolate
+        ivec2 i = ivec2(floor(st));
+        vec2 f = fract(st);
+        fragmentColor = mix(mix(paletteColor(i), paletteColor(i + ivec2(1, 0)), f.x),
+                            mix(paletteColor(i + ivec2(0, 1)), paletteColor(i + ivec2(1, 1)), f.x), f.y);
+    }
+)";
+
+/**
+ * @brief Fragment shader in GLSL that evaluates the Circle Limit tiling per fragment.
+ *
+ * @details Instead of sampling a texture, this shader maps the texture coordinates into the Poincare disk and
+ * counts the circles containing the fragment. The circles are read from a texture buffer, one texel per circle
+ * holding the centre and the squared radius.
+ */
+const char *proceduralFragmentSource = R"(
+    #version 330
+    precision highp float;
+
+    uniform samplerBuffer circles; ///< Circles as (centre x, centre y, radius squared, 0)
+    uniform int circleCount;       ///< Number of circles in the buffer
+
+    in vec2 texCoord;              ///< variable input: interpolated texture coordinates
+    out vec4 fragmentColor;        ///< output that goes to the raster memory as told by glBindFragDataLocation
+
+    void main() {
+        vec2 p = texCoord * 2.0 - 1.0;              ///< same mapping as PoincareGenerator::texelClass
+        if (dot(p, p) > 1.0) {
+            fragmentColor = vec4(0, 0, 0, 1);       ///< outside of the disk
+            return;
+        }
+        bool odd = false;
+        for (int i = 0; i < circleCount; i++) {
+            vec4 circle = texelFetch(circles, i);
+            vec2 d = p - circle.xy;
+            if (dot(d, d) <= circle.z) odd = !odd;
+        }
+        fragmentColor = odd ? vec4(0, 0, 1, 1) : vec4(1, 1, 0, 1);
+    }
+)";
+
+/**
+ * @brief Fragment shader in GLSL that samples the tile atlas of a VirtualTexture.
+ *
+ * @details The page table has one texel per visible tile of the current level, holding the scale and offset that take
+ * the texture coordinates into the atlas slot of that tile or of a coarser one standing in for it. Outside the page
+ * table the level 0 tile is used.
+ */
+const char *virtualFragmentSource = R"(
+    #version 330
+    precision highp float;
+
+    uniform sampler2D atlas;       ///< the resident tiles, each with a border of one texel
+    uniform sampler2D pageTable;   ///< per visible tile: scale, offset and level of the atlas slot to sample
+    uniform int pageLevel;         ///< the level of the tiles of the page table
+    uniform vec2 pageOrigin;       ///< the tile of the level in the first texel of the page table
+    uniform vec4 rootEntry;        ///< the page table entry of the level 0 tile
+
+    in vec2 texCoord;              ///< variable input: interpolated texture coordinates
+    out vec4 fragmentColor;        ///< output that goes to the raster memory as told by glBindFragDataLocation
+
+    void main() {
+        vec2 uv = clamp(texCoord, 0.0, 1.0);
+        ivec2 cell = ivec2(floor(uv * float(1 << pageLevel) - pageOrigin));
+        vec4 entry = rootEntry;
+        if (all(greaterThanEqual(cell, ivec2(0))) && all(lessThan(cell, textureSize(pageTable, 0))))
+            entry = texelFetch(pageTable, cell, 0);
+        fragmentColor = texture(atlas, uv * entry.x + entry.yz);
+    }
+)";
+
+/**
+ * @brief Fragment shader in GLSL that samples a layer of the texture variants.
+ *
+ * @details The array texture of TextureVariants is bound to four consecutive units, each with the sampler object of
+ * one filtering, so both the layer and the filtering are picked by a uniform.
+ */
+const char *variantFragmentSource = R"(
+    #version 330
+    precision highp float;
+
+    uniform sampler2DArray variants[4]; ///< the variants, filtered nearest, linear, trilinear and anisotropic
+    uniform int variantFilter;          ///< the element of variants to sample
+    uniform float variantLayer;         ///< the layer of the variant to show
+
+    in vec2 texCoord;              ///< variable input: interpolated texture coordinates
+    out vec4 fragmentColor;        ///< output that goes to the raster memory as told by glBindFragDataLocation
+
+    void main() {
+        vec3 coordinate = vec3(texCoord, variantLayer);
+        if (variantFilter == 0) fragmentColor = texture(variants[0], coordinate); ///< constant indices, as in GLSL 3.30
+        else if (variantFilter == 1) fragmentColor = texture(variants[1], coordinate);
+        else if (variantFilter == 2) fragmentColor = texture(variants[2], coordinate);
+        else fragmentColor = texture(variants[3], coordinate);
+    }
+)";
+
+/**
+ * @brief Vertex shader in GLSL for the stencil texture generator.
+ *
+ * @details Maps points of the Poincare disk to the pixels of the texture being generated.
+ */
+const char *stencilVertexSource = R"(
+    #version 330
+    precision highp float;
+
+    uniform vec2 scale;         ///< scale from disk coordinates to normalized device coordinates
+    uniform vec2 offset;        ///< offset from disk coordinates to normalized device coordinates
+
+    layout(location = 0) in vec2 vertexPosition;    ///< Attrib Array 0
+
+    void main() {
+        gl_Position = vec4(vertexPosition * scale + offset, 0, 1);
+    }
+)";
+
+/**
+ * @brief Fragment shader in GLSL for the stencil texture generator, it writes a single colour.
+ */
+const char *stencilFragmentSource = R"(
+    #version 330
+    precision highp float;
+
+    uniform vec4 color;            ///< colour of the region being filled
+    out vec4 fragmentColor;        ///< output that goes to the raster memory as told by glBindFragDataLocation
+
+    void main() {
+        fragmentColor = color;
+    }
+)";
+
+/**
+ * @class Camera2D
+ *
+ * @brief A 2D camera class.
+ *
+ * @details This class represents a 2D camera with a center and size in world coordinates.
+ * It provides methods to get the view and projection matrices.
+ */
+class Camera2D {
+    vec2 wCenter;        ///< center in world coordinates
+    vec2 wSize;          ///< width and height in world coordinates
+    float magnification; ///< the default size divided by the current one
+
+public:
+    static const int maxMagnification = 4096; ///< the deepest zoom
+
+    /**
+     * @brief Construct a new Camera2D object with default center and size.
+     */
+    Camera2D() : wCenter(20, 30), wSize(150, 150), magnification(1) {}
+
+    /**
+     * @brief Zoom in or out, keeping a point of the world at the same place in the window.
+     *
+     * @details The magnification stays between 1, where the camera returns to its default window, and
+     * maxMagnification.
+     *
+     * @param factor The change of the magnification, greater than 1 to zoom in.
+     * @param pivot The point that stays in place, in world coordinates.
+     */
+    void zoom(float factor, vec2 pivot) {
+        float target = std::min(std::max(magnification * factor, 1.0f), static_cast<float>(maxMagnification));
+        if (target == 1) {
+            *this = Camera2D();
+            return;
+        }
+        factor = target / magnification;
+        wCenter = pivot + (wCenter - pivot) / factor;
+        wSize = wSize / factor;
+        magnification = target;
+    }
+
+    /**
+     * @brief Get the magnification of the camera.
+     *
+     * @return float The default size divided by the current one.
+     */
+    float getMagnification() const { return magnification; }
+
+    /**
+     * @brief Get the point of the world under a pixel of the window.
+     *
+     * @param pX The column of the pixel, from the left.
+     * @param pY The row of the pixel, from the top.
+     * @return vec2 The point in world coordinates.
+     */
+    vec2 windowToWorld(int pX, int pY) const {
+        vec2 ndc(2.0f * (float)pX / windowWidth - 1, 1.0f - 2.0f * (float)pY / windowHeight);
+        return wCenter + ndc * wSize * 0.5f;
+    }
+
+    /**
+     * @brief Get the center of the camera window.
+     *
+     * @return vec2 The center in world coordinates.
+     */
+    vec2 getCenter() const { return wCenter; }
+
+    /**
+     * @brief Get the size of the camera window.
+     *
+     * @return vec2 The width and height in world coordinates.
+     */
+    vec2 getSize() const { return wSize; }
+
+    /**
+     * @brief Get the view matrix.
+     *
+     * @return mat4 The view matrix.
+     */
+    mat4 V() { return TranslateMatrix(-wCenter); }
+
+    /**
+     * @brief Get the projection matrix.
+     *
+     * @return mat4 The projection matrix.
+     */
+    mat4 P() const { return ScaleMatrix(vec2(2 / wSize.x, 2 / wSize.y)); }
+};
+
+Camera2D camera;       // 2D camera
+GPUProgram gpuProgram; // vertex and fragment shaders
+GPUProgram proceduralProgram; // vertex shader and the procedural fragment shader
+bool proceduralMode = false;  // shade the star with proceduralProgram instead of the texture
+GPUProgram virtualProgram;    // vertex shader and the virtual texture fragment shader
+bool virtualMode = false;     // shade the star from virtualTexture instead of the texture
+GPUProgram variantProgram;    // vertex shader and the fragment shader sampling the texture variants
+bool variantMode = false;     // shade the star from textureVariants instead of the texture
+std::atomic<bool> verbose{false}; // print every setting change and texture cache event, toggled with 'o'
+
+/**
+ * @brief Prints a message on the console in verbose mode only, from any thread.
+ * @param format The printf format of the message.
+ */
+void verbosePrintf(const char *format, ...) {
+    if (!verbose.load(std::memory_order_relaxed)) return;
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+/**
+ * @struct FrameData
+ * @brief The per-frame data of the shaders, laid out like the std140 FrameData block of vertexSource.
+ */
+struct FrameData {
+    mat4 VP; ///< View-Projection matrix of the camera.
+};
+
+const unsigned int frameDataBinding = 0; // uniform buffer binding point of FrameData
+UniformBuffer frameUniforms;             // FrameData, shared by gpuProgram and proceduralProgram
+
+WorkerPool workerPool; // threads shared by the texture generators
+VirtualTexture *virtualTexture = nullptr; // the tile pyramid of the 'w' mode, created when it is first used
+
+/**
+ * @enum TexelFormat
+ * @brief The formats a PoincareTexture can be stored in.
+ */
+enum TexelFormat {
+    FORMAT_RGBA32F, ///< Float RGBA colours, 16 bytes per texel.
+    FORMAT_RGBA8,   ///< 8-bit RGBA colours, 4 bytes per texel.
+    FORMAT_PALETTE, ///< One byte texel class per texel, coloured by the fragment shader.
+    FORMAT_COUNT    ///< The number of formats.
+};
+
+/**
+ * @brief Get the printable name of a texel format.
+ * @param format The format.
+ * @return The name of the format.
+ */
+inline const char *texelFormatName(TexelFormat format) {
+    switch (format) {
+        case FORMAT_RGBA8: return "RGBA8";
+        case FORMAT_PALETTE: return "R8 palette";
+        default: return "RGBA32F";
+    }
+}
+
+/**
+ * @brief Get the sized internal format a texel format is stored in.
+ * @param format The format.
+ * @return GL_RGBA32F, GL_RGBA8 or GL_R8.
+ */
+inline GLint texelInternalFormat(TexelFormat format) {
+    switch (format) {
+        case FORMAT_RGBA8: return GL_RGBA8;
+        case FORMAT_PALETTE: return GL_R8;
+        default: return GL_RGBA32F;
+    }
+}
+
+/**
+ * @enum RegenerationMode
+ * @brief How PoincareTexture regenerates its texture when the resolution or the settings change.
+ */
+enum RegenerationMode {
+    REGENERATE_BLOCKING,    ///< Generate the whole texture at once before returning.
+    REGENERATE_PROGRESSIVE, ///< Show a coarse preview at once and refine it across frames.
+    REGENERATE_BACKGROUND,  ///< Generate on a background thread, keep showing the old texture until it is done.
+    REGENERATE_COUNT        ///< The number of modes.
+};
+
+/**
+ * @brief Get the printable name of a regeneration mode.
+ * @param mode The mode.
+ * @return The name of the mode.
+ */
+inline const char *regenerationModeName(RegenerationMode mode) {
+    switch (mode) {
+        case REGENERATE_PROGRESSIVE: return "progressive";
+        case REGENERATE_BACKGROUND: return "background";
+        default: return "blocking";
+    }
+}
+
+/**
+ * @enum BandState
+ * @brief The state of a region of the pixel unpack ring PoincareTexture streams bands of texels through.
+ */
+enum BandState {
+    BAND_FREE,     ///< The region may be written.
+    BAND_FILLING,  ///< A thread is rendering a band into the region.
+    BAND_FILLED,   ///< The band is rendered and waits to be uploaded.
+    BAND_UPLOADING ///< The band is being copied into the texture, until the fence of the upload is signalled.
+};
+
+/**
+ * @struct StreamBand
+ * @brief A band of rows of a texture in a region of the pixel unpack ring.
+ */
+struct StreamBand {
+    BandState state = BAND_FREE; ///< The state of the region.
+    unsigned long id = 0;        ///< The id of the background request the band belongs to.
+    int firstRow = 0;            ///< The first row of the band.
+    int rows = 0;                ///< The number of rows of the band.
+};
+
+/**
+ * @struct TextureKey
+ * @brief The settings that determine the content of a generated texture.
+ */
+struct TextureKey {
+    int width = 0;  ///< The width of the texture.
+    int height = 0; ///< The height of the texture.
+    TextureGenerator generator = GENERATOR_CPU; ///< The generator that rendered the texture.
+    TexelFormat format = FORMAT_RGBA8; ///< The format of the texture.
+    SimdLevel simdLevel = SIMD_SCALAR; ///< The parity kernel, the NEON one can change texels lying exactly on a circle.
+    int samples = 1; ///< The subsamples per axis of the anti-aliased edge texels, 1 without anti-aliasing.
+    TilingSpec tiling; ///< The tiling drawn into the texture.
+
+    /**
+     * @brief Compare two keys.
+     * @param key The other key.
+     * @return True if both keys describe the same texture.
+     */
+    bool operator==(const TextureKey &key) const {
+        return width == key.width && height == key.height && generator == key.generator &&
+               format == key.format && simdLevel == key.simdLevel && samples == key.samples && tiling == key.tiling;
+    }
+};
+
+/**
+ * @class TextureCache
+ * @brief A bounded least-recently-used cache of generated GPU textures.
+ *
+ * @details The cache owns the textures it holds, which are moved in and out of it, and deletes the least recently
+ * used ones once their total size exceeds the memory budget. Hits, misses and evictions are counted, and reported on
+ * the console in verbose mode.
+ */
+class TextureCache {
+    /**
+     * @struct Entry
+     * @brief A texture in the cache.
+     */
+    struct Entry {
+        TextureKey key;  ///< The settings the texture was generated with.
+        Texture texture; ///< The texture.
+    };
+
+    std::list<Entry> entries; ///< The textures, the most recently used first.
+    size_t budget = 256 << 20; ///< The most GPU memory the cached textures may take in bytes.
+    size_t used = 0;           ///< The GPU memory the cached textures take in bytes.
+
+    /**
+     * @brief Deletes the least recently used textures until the cache fits into the budget.
+     */
+    void evict() {
+        while (used > budget && !entries.empty()) {
+            Entry &entry = entries.back();
+            verbosePrintf("Texture cache eviction: %dx%d %s\n", entry.key.width, entry.key.height,
+                          texelFormatName(entry.key.format));
+            used -= entry.texture.info.bytes();
+            entries.pop_back();
+            evictions++;
+        }
+    }
+
+public:
+    unsigned long hits = 0;      ///< The number of lookups that found a texture.
+    unsigned long misses = 0;    ///< The number of lookups that did not find a texture.
+    unsigned long evictions = 0; ///< The number of textures deleted to stay within the budget.
+
+    TextureCache() = default;
+    TextureCache(const TextureCache &) = delete;
+    TextureCache &operator=(const TextureCache &) = delete;
+
+    /**
+     * @brief Sets the memory budget and evicts textures that no longer fit.
+     * @param bytes The most GPU memory the cached textures may take in bytes.
+     */
+    void setBudget(size_t bytes) {
+        budget = bytes;
+        evict();
+    }
+
+    /**
+     * @brief Get the GPU memory the cached textures take.
+     * @return The size of the cached textures in bytes.
+     */
+    size_t usedBytes() const { return used; }
+
+    /**
+     * @brief Moves a texture out of the cache, the caller becomes its owner.
+     * @param key The settings of the texture.
+     * @param texture Receives the texture that was found.
+     * @return False if the texture is not in the cache.
+     */
+    bool take(const TextureKey &key, Texture &texture) {
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (it->key == key) {
+                texture = std::move(it->texture);
+                used -= texture.info.bytes();
+                entries.erase(it);
+                hits++;
+                verbosePrintf("Texture cache hit: %dx%d %s (%lu hits, %lu misses)\n", key.width, key.height,
+                              texelFormatName(key.format), hits, misses);
+                return true;
+            }
+        }
+        misses++;
+        return false;
+    }
+
+    /**
+     * @brief Moves a texture into the cache as the most recently used one, the cache becomes its owner.
+     * @param key The settings the texture was generated with.
+     * @param texture The texture.
+     */
+    void put(const TextureKey &key, Texture &&texture) {
+        used += texture.info.bytes();
+        entries.push_front({key, std::move(texture)});
+        evict();
+    }
+};
+
+/**
+ * @struct TextureUniforms
+ * @brief The uniforms of the texture fragment shader that PoincareTexture::bind sets, resolved once per program.
+ *
+ * The palette colours and the distance range never change and are set by resolve. The modes are only set when they
+ * differ from the ones last written into the program.
+ */
+struct TextureUniforms {
+    UniformHandle distanceMode;  ///< Sample the texture as a distance field.
+    UniformHandle paletteMode;   ///< Colour the texel classes of a palette texture.
+    UniformHandle paletteLinear; ///< Filter the palette texture bilinearly in the shader.
+    int modes = -1;              ///< The modes last set as bits 1, 2 and 4 of the three flags, -1 for none.
+
+    /**
+     * @brief Resolve the uniforms and set the constant ones.
+     * @param program The texturing GPU program, it must be in use.
+     */
+    void resolve(GPUProgram &program) {
+        distanceMode = program.getUniform("distanceMode");
+        paletteMode = program.getUniform("paletteMode");
+        paletteLinear = program.getUniform("paletteLinear");
+        program.setUniform(PoincareGenerator::distanceRange, "distanceRange");
+        program.setUniform(classColor(CLASS_OUTSIDE), "palette[0]");
+        program.setUniform(classColor(CLASS_EVEN), "palette[1]");
+        program.setUniform(classColor(CLASS_ODD), "palette[2]");
+        modes = -1;
+    }
+};
+
+/**
+ * @class PoincareTexture
+ * @brief A class that extends the Texture class to create a Poincare texture.
+ *
+ * This class is used to create a Poincare texture by performing various mathematical operations.
+ * It contains methods to increase the resolution of the texture, set the filtering mode, and render the texture.
+ */
+class PoincareTexture : public Texture {
+private:
+    int width, height; ///< The width and height of the texture.
+    PoincareGenerator tiling; ///< The circles of the tiling and the CPU generators.
+    unsigned int circleBuffer = 0; ///< The buffer object holding the circles for the procedural shader.
+    unsigned int circleBufferTexture = 0; ///< The texture buffer reading circleBuffer.
+    TextureGenerator generator = GENERATOR_CPU; ///< The generator used when the texture is (re)generated.
+    TexelFormat format = FORMAT_RGBA8; ///< The format the texture is stored in.
+    GLenum filteringMode = GL_LINEAR; ///< The filtering mode selected with setFilteringMode.
+    bool anisotropic = false; ///< Filter anisotropically on top of the filtering mode, see setAnisotropic.
+    int antialiasSamples = 1; ///< The subsamples per axis of the edge texels, 1 turns anti-aliasing off.
+    double lastRegenerationMs = 0; ///< The wall time of the last regeneration including the upload.
+    RegenerationMode regenerationMode = REGENERATE_BACKGROUND; ///< How regenerate generates the texture.
+    static const int coarsestStep = 8; ///< The grid step of the first progressive preview.
+    int progressiveStep = 0; ///< The grid step of the last progressive level, 1 or less when complete.
+    std::vector<unsigned char> progressiveClasses; ///< The samples computed so far by the progressive levels.
+    TextureCache cache; ///< Textures generated earlier with other settings.
+    TextureKey currentKey; ///< The settings the current texture was generated with.
+    bool currentComplete = false; ///< The current texture is fully generated and may be cached.
+    std::thread backgroundThread; ///< Generates textures for REGENERATE_BACKGROUND, started on first use.
+    std::mutex backgroundMutex; ///< Guards the request and the result of the background thread.
+    std::condition_variable backgroundWakeUp; ///< Signals the background thread a new request or stopping.
+    std::atomic<unsigned long> latestRequest{0}; ///< The id of the newest request, older jobs are cancelled.
+    bool requestPending = false; ///< There is a request the background thread has not started yet.
+    bool backgroundRunning = false; ///< The background thread is generating a texture.
+    TextureKey requestKey; ///< The settings of the pending request.
+    unsigned long requestId = 0; ///< The id of the pending request.
+    TextureKey inFlightKey; ///< The settings of the last request, which generate does not request again.
+    unsigned long inFlightId = 0; ///< The id of the last request until its texture is swapped in, 0 if there is none.
+    bool resultReady = false; ///< The background thread has finished a texture that is not swapped in yet.
+    TextureKey resultKey; ///< The settings of the finished texture.
+    unsigned long resultId = 0; ///< The id of the request of the finished texture.
+    double resultMs = 0; ///< The time the background thread took for the finished texture.
+    std::vector<unsigned char> resultClasses; ///< The texel classes of the finished texture.
+    std::vector<vec4> resultColors; ///< The anti-aliased colours of the finished texture, empty without anti-aliasing.
+    bool backgroundStopping = false; ///< Tells the background thread to exit.
+    GPUProgram stencilProgram; ///< The program drawing the circles of the stencil generator.
+    unsigned int fanVao = 0; ///< The vertex array of the circle fans of the stencil generator.
+    unsigned int fanVbo = 0; ///< The vertex buffer of the circle fans of the stencil generator.
+    unsigned int framebuffer = 0; ///< The framebuffer the stencil generator renders into.
+    unsigned int stencilBuffer = 0; ///< The depth-stencil renderbuffer of the framebuffer.
+    static const size_t regionBytes = 16 << 20; ///< The size of a region of the pixel unpack ring.
+    static const int ringRegions = 3; ///< The regions of the ring, one rendered while the others are copied.
+    PixelUnpackRing uploadRing; ///< The mapped buffer the streamed texels are rendered into, created on first use.
+    bool ringFailed = false; ///< The ring cannot be created, the texels are uploaded from host images.
+    std::vector<StreamBand> streamBands; ///< The bands in the regions of the ring, guarded by backgroundMutex.
+    bool requestStreamed = false; ///< The pending request is streamed through the ring.
+    Texture streamTexture; ///< The texture the bands of the streamed background request are uploaded into.
+    TextureKey streamKey; ///< The settings of the streamed background request.
+    unsigned long streamId = 0; ///< The id of the streamed background request, 0 if there is none.
+    int streamRows = 0; ///< The rows of streamTexture uploaded so far.
+    double streamStart = 0; ///< The time stamp the streamed background request was made at.
+
+public:
+    /**
+     * @brief Constructor for the PoincareTexture class.
+     * @param width The width of the texture.
+     * @param height The height of the texture.
+     */
+    PoincareTexture(int width, int height) : width(width), height(height), tiling(workerPool) {
+        uploadCircles();
+        regenerate(false);
+    }
+
+    PoincareTexture(const PoincareTexture &) = delete;
+    PoincareTexture &operator=(const PoincareTexture &) = delete;
+
+    /**
+     * @brief Destructor, deletes the circle buffer of the procedural shader.
+     */
+    ~PoincareTexture() {
+        stopBackground();
+        if (circleBufferTexture > 0) glDeleteTextures(1, &circleBufferTexture);
+        if (circleBuffer > 0) glDeleteBuffers(1, &circleBuffer);
+        if (fanVbo > 0) glDeleteBuffers(1, &fanVbo);
+        if (fanVao > 0) glDeleteVertexArrays(1, &fanVao);
+        if (stencilBuffer > 0) glDeleteRenderbuffers(1, &stencilBuffer);
+        if (framebuffer > 0) glDeleteFramebuffers(1, &framebuffer);
+    }
+
+    /**
+     * @brief Generates the texture at the current resolution with the selected generator.
+     * @param allowBackground Hand the generation to the background thread if that mode is selected.
+     */
+    void regenerate(bool allowBackground = true) {
+        double start = timestampMs();
+        if (generate(allowBackground)) lastRegenerationMs = timestampMs() - start;
+    }
+
+    /**
+     * @brief Generates the texture, the work behind regenerate.
+     * @param allowBackground Hand the generation to the background thread if that mode is selected.
+     * @return True if the texture was generated, false if it was handed to the background thread.
+     */
+    bool generate(bool allowBackground) {
+        TRACE_ZONE("PoincareTexture::generate");
+        TextureKey key = settingsKey();
+        if (allowBackground && regenerationMode == REGENERATE_BACKGROUND && inFlightId != 0 &&
+            inFlightId == latestRequest.load() && inFlightKey == key)
+            return false; // the background thread is generating these settings already, the lookup was counted
+        progressiveStep = 0;
+        progressiveClasses.clear();
+        cancelBackground();
+        Texture cached;
+        bool hit = cache.take(key, cached);
+        if (!hit && allowBackground && regenerationMode == REGENERATE_BACKGROUND &&
+            generator != GENERATOR_STENCIL && textureId != 0) {
+            requestBackground(key);
+            return false;
+        }
+        retireCurrent();
+        currentKey = key;
+        currentComplete = true;
+        if (hit) {
+            swap(cached); // an incomplete texture that was kept by retireCurrent is deleted with cached
+            applyFilteringMode();
+            return true;
+        }
+        if (generator == GENERATOR_STENCIL) {
+            if (renderWithStencil(width, height)) return true;
+            currentKey.generator = GENERATOR_CPU;
+            currentKey.simdLevel = tiling.getSimdLevel();
+            if (format != FORMAT_PALETTE) currentKey.samples = antialiasSamples;
+        }
+        if (regenerationMode == REGENERATE_PROGRESSIVE && generator == GENERATOR_CPU) {
+            startProgressive();
+            currentComplete = false;
+        } else if (generator == GENERATOR_DISTANCE) {
+            std::vector<unsigned char> texels;
+            tiling.renderDistanceField(width, height, texels, [] { return false; });
+            uploadDistances(texels);
+        } else if (!streamTexels(currentKey)) {
+            uploadClasses(tiling.RenderClasses(width, height, generator));
+        }
+        return true;
+    }
+
+    /**
+     * @brief Checks whether a texture can be streamed through the pixel unpack ring, creating the ring on first use.
+     *
+     * @details The ring takes texels of the CPU generators that are final when a band is rendered, so anti-aliased
+     * textures, which need the neighbouring rows, are still uploaded from host images.
+     *
+     * @param key The settings of the texture.
+     * @return True if the texture can be streamed.
+     */
+    bool streamable(const TextureKey &key) {
+        if (key.generator == GENERATOR_STENCIL || key.generator == GENERATOR_DISTANCE) return false;
+        if (key.samples > 1 || key.format == FORMAT_RGBA32F || ringFailed) return false; // the ring holds bytes
+        if (uploadRing.getRegionCount() > 0) return true;
+        if (!uploadRing.create(regionBytes, ringRegions)) {
+            ringFailed = true;
+            return false;
+        }
+        streamBands.assign(ringRegions, StreamBand());
+        return true;
+    }
+
+    /**
+     * @brief Get the layout of the streamed texels of a format.
+     * @param texelFormat The format of the texture.
+     * @return Classes for the palette, whose texture holds them, bytes otherwise, the storage of both colour formats.
+     */
+    static TexelLayout streamLayout(TexelFormat texelFormat) {
+        return texelFormat == FORMAT_PALETTE ? TEXELS_CLASSES : TEXELS_RGBA8;
+    }
+
+    /**
+     * @brief Get the rows of the bands a texture is streamed in.
+     *
+     * @details A band fills at most a region, spans a few tasks of every thread of the pool, and the texture has
+     * several bands so that they overlap.
+     *
+     * @param key The settings of the texture.
+     * @return The number of rows of a band, a multiple of the band height of the pool tasks unless the region is full.
+     */
+    static int streamBandRows(const TextureKey &key) {
+        int band = PoincareGenerator::bandHeight;
+        int fitting = static_cast<int>(regionBytes / ((size_t)key.width * texelBytes(streamLayout(key.format))));
+        int rows = std::max((key.height / 8 + band - 1) / band, 2 * workerPool.getThreadCount()) * band;
+        return std::max(1, std::min(rows, fitting));
+    }
+
+    /**
+     * @brief Allocates the storage for a streamed texture.
+     * @param texture The texture.
+     * @param key The settings of the texture.
+     */
+    static void allocateStreamed(Texture &texture, const TextureKey &key) {
+        bool palette = key.format == FORMAT_PALETTE;
+        texture.allocate(key.width, key.height, palette ? GL_R8 : GL_RGBA8, !palette);
+        texture.info.mipmapsValid = false;
+    }
+
+    /**
+     * @brief Uploads a rendered band from its region into a texture and fences the upload.
+     * @param region The region of the band.
+     * @param texture The texture.
+     * @param key The settings of the texture.
+     */
+    void uploadBand(int region, Texture &texture, const TextureKey &key) {
+        const StreamBand &band = streamBands[region];
+        bool palette = key.format == FORMAT_PALETTE;
+        uploadRing.upload(region, texture.textureId, band.firstRow, key.width, band.rows, palette ? GL_RED : GL_RGBA,
+                          GL_UNSIGNED_BYTE);
+        streamBands[region].state = BAND_UPLOADING;
+    }
+
+    /**
+     * @brief Generates the texture on this thread band by band straight into the pixel unpack ring.
+     *
+     * @details The upload of a band returns at once, the next band is rendered while the GPU copies it. A region is
+     * reused once the fence of its upload is signalled, which rarely has to wait with three regions.
+     *
+     * @param key The settings of the texture.
+     * @return False if the texture cannot be streamed and nothing was generated.
+     */
+    bool streamTexels(const TextureKey &key) {
+        if (!streamable(key)) return false;
+        TRACE_ZONE("PoincareTexture::streamTexels");
+        TexelLayout layout = streamLayout(key.format);
+        int bandRows = streamBandRows(key);
+        allocateStreamed(*this, key);
+        for (int firstRow = 0; firstRow < height; firstRow += bandRows) {
+            int region = claimRegion();
+            StreamBand &band = streamBands[region];
+            band.firstRow = firstRow;
+            band.rows = std::min(bandRows, height - firstRow);
+            tiling.renderTexels(width, firstRow, firstRow + band.rows, key.generator, layout, uploadRing.data(region),
+                                [] { return false; });
+            std::lock_guard<std::mutex> lock(backgroundMutex);
+            uploadBand(region, *this, key);
+        }
+        applyFilteringMode();
+        return true;
+    }
+
+    /**
+     * @brief Claims a region of the ring for the main thread, after the background requests were cancelled.
+     * @return The region, marked as filling.
+     */
+    int claimRegion() {
+        std::lock_guard<std::mutex> lock(backgroundMutex);
+        for (bool wait = false;; wait = true) {
+            for (int region = 0; region < ringRegions; region++) {
+                StreamBand &band = streamBands[region];
+                if (band.state == BAND_FILLED) band.state = BAND_FREE; // of a cancelled request
+                if (band.state == BAND_UPLOADING && uploadRing.ready(region, wait)) band.state = BAND_FREE;
+                if (band.state == BAND_FREE) {
+                    band.state = BAND_FILLING;
+                    return region;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Renders the bands of a streamed background request into the free regions of the ring.
+     * @param key The settings of the texture.
+     * @param id The id of the request.
+     * @return False if the request was cancelled.
+     */
+    bool streamBackground(const TextureKey &key, unsigned long id) {
+        TexelLayout layout = streamLayout(key.format);
+        int bandRows = streamBandRows(key);
+        auto cancelled = [&] { return latestRequest.load() != id; };
+        for (int firstRow = 0; firstRow < key.height; firstRow += bandRows) {
+            int region = -1;
+            {
+                std::unique_lock<std::mutex> lock(backgroundMutex);
+                backgroundWakeUp.wait(lock, [&] {
+                    for (int i = 0; i < ringRegions && region < 0; i++)
+                        if (streamBands[i].state == BAND_FREE) region = i;
+                    return backgroundStopping || cancelled() || region >= 0;
+                });
+                if (backgroundStopping || cancelled()) return false;
+                streamBands[region].state = BAND_FILLING;
+            }
+            int rows = std::min(bandRows, key.height - firstRow);
+            bool rendered = tiling.renderTexels(key.width, firstRow, firstRow + rows, key.generator, layout,
+                                                uploadRing.data(region), cancelled);
+            std::lock_guard<std::mutex> lock(backgroundMutex);
+            StreamBand &band = streamBands[region];
+            band.state = rendered ? BAND_FILLED : BAND_FREE;
+            band.id = id;
+            band.firstRow = firstRow;
+            band.rows = rows;
+            if (!rendered) return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Uploads the bands the background thread has rendered and swaps the texture in once it is complete.
+     *
+     * @details It frees the regions whose uploads are done without waiting, so the background thread can go on,
+     * and drops the bands of cancelled requests. Call it whenever the background work is polled.
+     *
+     * @return True if a new texture was swapped in.
+     */
+    bool pumpUploads() {
+        TRACE_ZONE("PoincareTexture::pumpUploads");
+        bool freed = false, complete = false;
+        {
+            std::lock_guard<std::mutex> lock(backgroundMutex);
+            for (int region = 0; region < static_cast<int>(streamBands.size()); region++) {
+                StreamBand &band = streamBands[region];
+                if (band.state == BAND_UPLOADING && uploadRing.ready(region, false)) band.state = BAND_FREE;
+                if (band.state == BAND_FILLED && (band.id != streamId || band.id != latestRequest.load()))
+                    band.state = BAND_FREE;
+                if (band.state == BAND_FILLED) {
+                    uploadBand(region, streamTexture, streamKey);
+                    streamRows += band.rows;
+                    complete = streamRows == streamKey.height;
+                }
+                freed = freed || band.state == BAND_FREE;
+            }
+        }
+        if (freed) backgroundWakeUp.notify_one();
+        if (!complete) return false;
+        streamId = 0;
+        inFlightId = 0;
+        retireCurrent();
+        swap(streamTexture);
+        currentKey = streamKey;
+        currentComplete = true;
+        applyFilteringMode();
+        lastRegenerationMs = timestampMs() - streamStart;
+        return true;
+    }
+
+    /**
+     * @brief Moves the current texture into the cache if it is complete, so that a new one can take its place.
+     *
+     * @details An incomplete texture is kept and overwritten by the next upload.
+     */
+    void retireCurrent() {
+        if (textureId != 0 && currentComplete) {
+            Texture retired;
+            swap(retired);
+            cache.put(currentKey, std::move(retired));
+        }
+    }
+
+    /**
+     * @brief Get the settings that determine the texture generated by regenerate.
+     * @return The settings of the texture.
+     */
+    TextureKey settingsKey() const {
+        TextureKey key;
+        key.width = width;
+        key.height = height;
+        key.generator = generator;
+        key.format = format;
+        key.simdLevel = generator == GENERATOR_CPU ? tiling.getSimdLevel() : SIMD_SCALAR;
+        bool colors = generator != GENERATOR_STENCIL && generator != GENERATOR_DISTANCE && format != FORMAT_PALETTE;
+        key.samples = colors ? antialiasSamples : 1;
+        key.tiling = tiling.getTiling();
+        return key;
+    }
+
+    /**
+     * @brief Sets the memory budget of the cache of textures generated with other settings.
+     * @param bytes The most GPU memory the cached textures may take in bytes.
+     */
+    void setCacheBudget(size_t bytes) { cache.setBudget(bytes); }
+
+    /**
+     * @brief Get the width of the texture.
+     * @return The width in texels.
+     */
+    int getWidth() const { return width; }
+
+    /**
+     * @brief Get the height of the texture.
+     * @return The height in texels.
+     */
+    int getHeight() const { return height; }
+
+    /**
+     * @brief Get the time the last regeneration took.
+     *
+     * @details It covers generating and uploading, on the background thread it is the time of the job that was
+     * swapped in, and for the progressive mode the sum of the levels so far.
+     *
+     * @return The time in milliseconds.
+     */
+    double getLastRegenerationMs() const { return lastRegenerationMs; }
+
+    /**
+     * @brief Get the GPU memory held by the texture, the cache and the circle buffer.
+     * @return The memory in bytes, mipmaps included.
+     */
+    size_t residentBytes() const {
+        return info.bytes() + cache.usedBytes() + tiling.getCircles().size() * sizeof(vec4);
+    }
+
+    /**
+     * @brief Uploads texel classes of the current resolution in the selected format.
+     * @param classes The texel classes, row by row.
+     * @param antialiased Anti-alias the edges if it is turned on, false for the progressive previews.
+     */
+    void uploadClasses(const std::vector<unsigned char> &classes, bool antialiased = true) {
+        TRACE_ZONE("PoincareTexture::uploadClasses");
+        if (antialiased && format != FORMAT_PALETTE && antialiasSamples > 1) {
+            std::vector<vec4> colors;
+            tiling.antialias(width, height, antialiasSamples, classes, colors, [] { return false; });
+            uploadColors(colors);
+            return;
+        }
+        if (format == FORMAT_PALETTE) {
+            create(width, height, classes, GL_R8, GL_NEAREST);
+        } else if (format == FORMAT_RGBA8) {
+            create(width, height, PoincareGenerator::classesToColors8(classes), GL_RGBA8, static_cast<int>(filteringMode), true);
+        } else {
+            auto im = PoincareGenerator::classesToColors(classes);
+            create(width, height, im, static_cast<int>(filteringMode), true, GL_RGBA32F);
+        }
+        applyFilteringMode();
+    }
+
+    /**
+     * @brief Uploads a signed distance field of the current resolution, see PoincareGenerator::renderDistanceRows.
+     * @param texels The two channel texels, row by row.
+     */
+    void uploadDistances(const std::vector<unsigned char> &texels) {
+        create(width, height, texels, GL_RG8, GL_LINEAR, true);
+        applyFilteringMode();
+    }
+
+    /**
+     * @brief Uploads anti-aliased colours of the current resolution in the selected colour format.
+     * @param colors The colours, row by row.
+     */
+    void uploadColors(const std::vector<vec4> &colors) {
+        if (format == FORMAT_RGBA8) {
+            create(width, height, PoincareGenerator::colorsToBytes(colors), GL_RGBA8, static_cast<int>(filteringMode), true);
+        } else {
+            create(width, height, colors, static_cast<int>(filteringMode), true, GL_RGBA32F);
+        }
+        applyFilteringMode();
+    }
+
+    /**
+     * @brief Selects the number of subsamples of the texels on an edge and regenerates the texture.
+     *
+     * @details Only the colour formats of the CPU generators are anti-aliased, see PoincareGenerator::antialias.
+     *
+     * @param samples The subsamples per axis, 1 turns anti-aliasing off.
+     */
+    void setAntialiasSamples(int samples) {
+        antialiasSamples = std::max(1, samples);
+        regenerate();
+    }
+
+    /**
+     * @brief Get the number of subsamples per axis of the texels on an edge.
+     * @return The subsamples per axis, 1 if anti-aliasing is off.
+     */
+    int getAntialiasSamples() const { return antialiasSamples; }
+
+    /**
+     * @brief Selects how the texture is regenerated and regenerates it that way.
+     * @param mode The regeneration mode.
+     */
+    void setRegenerationMode(RegenerationMode mode) {
+        regenerationMode = mode;
+        regenerate();
+    }
+
+    /**
+     * @brief Get how the texture is regenerated.
+     * @return The regeneration mode.
+     */
+    RegenerationMode getRegenerationMode() const { return regenerationMode; }
+
+    /**
+     * @brief Hands a texture to the background thread, replacing a request it has not started yet.
+     * @param key The settings of the texture.
+     */
+    void requestBackground(const TextureKey &key) {
+        std::lock_guard<std::mutex> lock(backgroundMutex);
+        if (!backgroundThread.joinable()) backgroundThread = std::thread(&PoincareTexture::backgroundLoop, this);
+        requestKey = key;
+        requestId = latestRequest.load();
+        requestPending = true;
+        inFlightKey = key;
+        inFlightId = requestId;
+        requestStreamed = streamable(key);
+        if (requestStreamed) {
+            allocateStreamed(streamTexture, key);
+            streamKey = key;
+            streamId = requestId;
+            streamRows = 0;
+            streamStart = timestampMs();
+        }
+        backgroundWakeUp.notify_one();
+    }
+
+    /**
+     * @brief Makes every request given to the background thread so far obsolete.
+     *
+     * @details A job that is running notices it between two bands and stops, a pending one is dropped, and a
+     * finished one is not swapped in.
+     */
+    void cancelBackground() {
+        latestRequest++;
+        std::lock_guard<std::mutex> lock(backgroundMutex);
+        requestPending = false;
+        resultReady = false;
+        resultClasses.clear();
+        resultColors.clear();
+    }
+
+    /**
+     * @brief Stops and joins the background thread.
+     */
+    void stopBackground() {
+        latestRequest++;
+        {
+            std::lock_guard<std::mutex> lock(backgroundMutex);
+            backgroundStopping = true;
+        }
+        backgroundWakeUp.notify_one();
+        if (backgroundThread.joinable()) backgroundThread.join();
+    }
+
+    /**
+     * @brief The main loop of the background thread, it generates the latest request.
+     */
+    void backgroundLoop() {
+        TraceRecorder::instance().nameThread("texture background");
+        while (true) {
+            TextureKey key;
+            unsigned long id;
+            bool streamed;
+            {
+                std::unique_lock<std::mutex> lock(backgroundMutex);
+                backgroundWakeUp.wait(lock, [&] { return backgroundStopping || requestPending; });
+                if (backgroundStopping) return;
+                key = requestKey;
+                id = requestId;
+                streamed = requestStreamed;
+                requestPending = false;
+                backgroundRunning = true;
+            }
+            TRACE_ZONE("PoincareTexture background job");
+            if (streamed) { // the main thread uploads the bands, see pumpUploads
+                bool rendered = streamBackground(key, id);
+                if (!rendered) verbosePrintf("Cancelled the obsolete %dx%d texture\n", key.width, key.height);
+                std::lock_guard<std::mutex> lock(backgroundMutex);
+                backgroundRunning = false;
+                continue;
+            }
+            std::vector<unsigned char> classes;
+            std::vector<vec4> colors;
+            double start = timestampMs();
+            auto cancelled = [&] { return latestRequest.load() != id; };
+            bool rendered = key.generator == GENERATOR_DISTANCE
+                            ? tiling.renderDistanceField(key.width, key.height, classes, cancelled)
+                            : tiling.renderClasses(key.width, key.height, key.generator, classes, cancelled) &&
+                              (key.samples <= 1 || tiling.antialias(key.width, key.height, key.samples, classes, colors, cancelled));
+            if (!rendered) {
+                verbosePrintf("Cancelled the obsolete %dx%d texture\n", key.width, key.height);
+                std::lock_guard<std::mutex> lock(backgroundMutex);
+                backgroundRunning = false;
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(backgroundMutex);
+            backgroundRunning = false;
+            if (latestRequest.load() != id) continue;
+            resultClasses.swap(classes);
+            resultColors.swap(colors);
+            resultMs = timestampMs() - start;
+            resultKey = key;
+            resultId = id;
+            resultReady = true;
+        }
+    }
+
+    /**
+     * @brief Checks whether the background thread has finished a texture that waits to be swapped in.
+     * @return True if swapIfReady would swap in a texture.
+     */
+    bool hasBackgroundResult() {
+        std::lock_guard<std::mutex> lock(backgroundMutex);
+        return resultReady && resultId == latestRequest.load();
+    }
+
+    /**
+     * @brief Checks whether the texture is still being worked on, in the background or by progressive levels.
+     * @return True if polling the texture will change it later.
+     */
+    bool isBusy() {
+        if (progressiveStep > 1) return true;
+        std::lock_guard<std::mutex> lock(backgroundMutex);
+        if (streamId != 0 && streamId == latestRequest.load()) return true;
+        return requestPending || backgroundRunning || resultReady;
+    }
+
+    /**
+     * @brief Uploads and swaps in the texture finished by the background thread, call it at the start of a frame.
+     * @return True if a new texture was swapped in.
+     */
+    bool swapIfReady() {
+        if (pumpUploads()) return true;
+        std::vector<unsigned char> classes;
+        std::vector<vec4> colors;
+        TextureKey key;
+        double start = timestampMs(), backgroundMs;
+        {
+            std::lock_guard<std::mutex> lock(backgroundMutex);
+            if (!resultReady) return false;
+            resultReady = false;
+            if (resultId != latestRequest.load()) return false;
+            inFlightId = 0;
+            classes.swap(resultClasses);
+            colors.swap(resultColors);
+            key = resultKey;
+            backgroundMs = resultMs;
+        }
+        retireCurrent();
+        currentKey = key;
+        currentComplete = true;
+        if (!colors.empty()) uploadColors(colors);
+        else if (key.generator == GENERATOR_DISTANCE) uploadDistances(classes); // the texels of the distance field
+        else uploadClasses(classes);
+        lastRegenerationMs = backgroundMs + timestampMs() - start;
+        return true;
+    }
 
-    in vec2 texCoord;              ///< variable input: interpolated texture coordinates
-    out vec4 fragmentColor;        ///< output that goes to the raster memory as told by glBindFragDataLocation
+    /**
+     * @brief Uploads the progressive samples computed so far, every sample filling its block of the grid.
+     */
+    void uploadProgressive() {
+        if (progressiveStep == 1) {
+            uploadClasses(progressiveClasses);
+            return;
+        }
+        std::vector<unsigned char> preview(progressiveClasses.size());
+        for (int yC = 0; yC < height; yC++) {
+            const unsigned char *samples = progressiveClasses.data() + (size_t)(yC - yC % progressiveStep) * width;
+            unsigned char *texels = preview.data() + (size_t)yC * width;
+            for (int xC = 0; xC < width; xC++) texels[xC] = samples[xC - xC % progressiveStep];
+        }
+        uploadClasses(preview, false);
+    }
 
-    void main() {
-        fragmentColor = texture(textureUnit, texCoord); ///< fetch color from texture
+    /**
+     * @brief Starts the progressive generation with the coarsest grid and uploads its preview.
+     */
+    void startProgressive() {
+        progressiveStep = coarsestStep;
+        progressiveClasses.assign((size_t)width * height, CLASS_OUTSIDE);
+        tiling.renderGridLevel(width, height, progressiveStep, true, progressiveClasses.data());
+        uploadProgressive();
     }
-)";
 
-/**
- * @class Camera2D
- *
- * @brief A 2D camera class.
- *
- * @details This class represents a 2D camera with a center and size in world coordinates.
- * It provides methods to get the view and projection matrices.
- */
-class Camera2D {
-    vec2 wCenter; ///< center in world coordinates
-    vec2 wSize;   ///< width and height in world coordinates
+    /**
+     * @brief Refines the progressive generation by one level, reusing the samples of the coarser levels.
+     * @return True if the texture has changed and needs to be redrawn.
+     */
+    bool refine() {
+        if (progressiveStep <= 1) return false;
+        TRACE_ZONE("PoincareTexture::refine");
+        double start = timestampMs();
+        progressiveStep /= 2;
+        tiling.renderGridLevel(width, height, progressiveStep, false, progressiveClasses.data());
+        uploadProgressive();
+        lastRegenerationMs += timestampMs() - start;
+        if (progressiveStep == 1) {
+            progressiveClasses.clear();
+            progressiveClasses.shrink_to_fit();
+            currentComplete = true;
+        }
+        return true;
+    }
 
-public:
     /**
-     * @brief Construct a new Camera2D object with default center and size.
+     * @brief Selects the format of the texture and regenerates the texture in it.
+     * @param newFormat The format to use.
      */
-    Camera2D() : wCenter(20, 30), wSize(150, 150) {}
+    void setFormat(TexelFormat newFormat) {
+        format = newFormat;
+        regenerate();
+    }
 
     /**
-     * @brief Get the view matrix.
+     * @brief Get the format the texture is stored in.
+     * @return The format.
+     */
+    TexelFormat getFormat() const { return format; }
+
+    /**
+     * @brief Binds the texture and sets the uniforms of the fragment shader that depend on the format.
+     * @param program The texturing GPU program, it must be in use.
+     * @param uniforms The uniforms of the program.
+     */
+    void bind(GPUProgram &program, TextureUniforms &uniforms) {
+        glBindTexture(GL_TEXTURE_2D, textureId);
+        bool distance = currentKey.generator == GENERATOR_DISTANCE;
+        bool palette = !distance && currentKey.format == FORMAT_PALETTE; // the bound texture, not the setting
+        bool linear = palette && filteringMode != GL_NEAREST;
+        int modes = (distance ? 1 : 0) | (palette ? 2 : 0) | (linear ? 4 : 0);
+        if (modes == uniforms.modes) return;
+        uniforms.modes = modes;
+        program.setUniform(distance ? 1 : 0, uniforms.distanceMode);
+        program.setUniform(palette ? 1 : 0, uniforms.paletteMode);
+        program.setUniform(linear ? 1 : 0, uniforms.paletteLinear);
+    }
+
+    /**
+     * @brief Selects the generator and regenerates the texture with it.
+     * @param newGenerator The generator to use.
+     */
+    void setGenerator(TextureGenerator newGenerator) {
+        generator = newGenerator;
+        regenerate();
+    }
+
+    /**
+     * @brief Get the generator used for the texture.
+     * @return The generator.
+     */
+    TextureGenerator getGenerator() const { return generator; }
+
+    /**
+     * @brief Selects the tiling, recomputes its circles and regenerates the texture.
      *
-     * @return mat4 The view matrix.
+     * @details The background thread reads the circles, so it is stopped first and started again by the next
+     * background request. Textures of the previous tiling stay in the cache.
+     *
+     * @param spec The tiling.
      */
-    mat4 V() { return TranslateMatrix(-wCenter); }
+    void setTiling(const TilingSpec &spec) {
+        stopBackground();
+        backgroundStopping = false;
+        progressiveStep = 0;
+        tiling.setTiling(spec);
+        uploadCircles();
+        regenerate();
+    }
 
     /**
-     * @brief Get the projection matrix.
+     * @brief Get the tiling drawn into the texture.
+     * @return The tiling.
+     */
+    const TilingSpec &getTiling() const { return tiling.getTiling(); }
+
+    /**
+     * @brief Get the number of circles of the tiling.
+     * @return The number of circles.
+     */
+    int getCircleCount() const { return static_cast<int>(tiling.getCircles().size()); }
+
+    /**
+     * @brief Builds one triangle fan per circle, plus one for the unit disk, into the fan vertex buffer.
      *
-     * @return mat4 The projection matrix.
+     * @details The number of segments grows with the radius in pixels, so that the polygon stays within half a
+     * pixel of the true circle.
+     *
+     * @param pixelsPerUnit The number of texels per unit of the disk coordinates.
+     * @param firsts The index of the first vertex of every fan.
+     * @param counts The number of vertices of every fan.
      */
-    mat4 P() const { return ScaleMatrix(vec2(2 / wSize.x, 2 / wSize.y)); }
-};
+    void buildCircleFans(float pixelsPerUnit, std::vector<GLint> &firsts, std::vector<GLsizei> &counts) {
+        std::vector<vec2> vertices;
+        std::vector<vec3> fans(tiling.getCircles());
+        fans.emplace_back(0.0f, 0.0f, 1.0f);
+        for (const vec3 &circle : fans) {
+            float radiusInPixels = circle.z * pixelsPerUnit;
+            int segments = std::max(32, static_cast<int>(ceilf(static_cast<float>(M_PI) * sqrtf(radiusInPixels))));
+            firsts.push_back(static_cast<GLint>(vertices.size()));
+            counts.push_back(segments + 2);
+            vertices.emplace_back(circle.x, circle.y);
+            for (int i = 0; i <= segments; i++) {
+                float angle = 2.0f * static_cast<float>(M_PI) * static_cast<float>(i % segments) / static_cast<float>(segments);
+                vertices.emplace_back(circle.x + circle.z * cosf(angle), circle.y + circle.z * sinf(angle));
+            }
+        }
+        if (fanVao == 0) {
+            glGenVertexArrays(1, &fanVao);
+            glGenBuffers(1, &fanVbo);
+        }
+        glBindVertexArray(fanVao);
+        glBindBuffer(GL_ARRAY_BUFFER, fanVbo);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vec2), vertices.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vec2), (void *) nullptr);
+    }
 
-Camera2D camera;       // 2D camera
-GPUProgram gpuProgram; // vertex and fragment shaders
+    /**
+     * @brief Renders the texture on the GPU with the stencil buffer counting the circle coverage.
+     *
+     * @details Every circle is drawn as a triangle fan with GL_INVERT as stencil operation and colour writes turned
+     * off, which leaves the parity of the number of covering circles in the lowest stencil bit. Then the unit disk
+     * is filled twice, once for each stencil value, with the colour of that parity, or its texel class in the
+     * palette format. The texture is the colour
+     * attachment of the framebuffer, so the image never leaves the GPU. The cost does not depend on how many
+     * circles overlap a texel.
+     *
+     * @param textureWidth The width of the texture.
+     * @param textureHeight The height of the texture.
+     * @return True if the texture was rendered, false if the framebuffer could not be set up.
+     */
+    bool renderWithStencil(int textureWidth, int textureHeight) {
+        TRACE_ZONE("PoincareTexture::renderWithStencil");
+        if (stencilProgram.getId() == 0 &&
+            !stencilProgram.create(stencilVertexSource, stencilFragmentSource, "fragmentColor")) return false;
+        bool palette = format == FORMAT_PALETTE;
+        allocate(textureWidth, textureHeight, texelInternalFormat(format), !palette);
 
-/**
- * @class PoincareTexture
- * @brief A class that extends the Texture class to create a Poincare texture.
- *
- * This class is used to create a Poincare texture by performing various mathematical operations.
- * It contains methods to increase the resolution of the texture, set the filtering mode, and render the texture.
- */
-class PoincareTexture : public Texture {
-private:
-    int width, height; ///< The width and height of the texture.
-    std::vector<vec3> points; ///< A vector of points.
-    std::vector<vec3> centres; ///< A vector of centres.
-    std::vector<vec3> hyperbolicPoints; ///< A vector of hyperbolic points.
-    std::vector<vec2> poincarePoints; ///< A vector of Poincare points.
-    std::vector<vec3> circles; ///< A vector of circles.
+        if (framebuffer == 0) {
+            glGenFramebuffers(1, &framebuffer);
+            glGenRenderbuffers(1, &stencilBuffer);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, stencilBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, textureWidth, textureHeight);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureId, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, stencilBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            printf("Stencil generator framebuffer is incomplete, falling back to the CPU\n");
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            return false;
+        }
+
+        std::vector<GLint> firsts;
+        std::vector<GLsizei> counts;
+        buildCircleFans(static_cast<float>(textureWidth) / 2, firsts, counts);
+
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glViewport(0, 0, textureWidth, textureHeight);
+        glClearColor(0, 0, 0, 1);
+        glClearStencil(0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+        // texel (xC, yC) holds the point (2 xC / width - 1, 2 yC / width - 1), as in PoincareGenerator::texelClass
+        float w = static_cast<float>(textureWidth), h = static_cast<float>(textureHeight);
+        stencilProgram.Use();
+        stencilProgram.setUniform(vec2(1, w / h), "scale");
+        stencilProgram.setUniform(vec2(1 / w, w / h - 1 + 1 / h), "offset");
+
+        glEnable(GL_STENCIL_TEST);
+        glStencilMask(1);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glStencilFunc(GL_ALWAYS, 0, 1);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_INVERT);
+        glMultiDrawArrays(GL_TRIANGLE_FAN, firsts.data(), counts.data(), static_cast<GLsizei>(tiling.getCircles().size()));
+
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        glStencilFunc(GL_EQUAL, 0, 1);
+        stencilProgram.setUniform(palette ? vec4(CLASS_EVEN / 255.0f) : classColor(CLASS_EVEN), "color");
+        glDrawArrays(GL_TRIANGLE_FAN, firsts.back(), counts.back());
+        glStencilFunc(GL_EQUAL, 1, 1);
+        stencilProgram.setUniform(palette ? vec4(CLASS_ODD / 255.0f) : classColor(CLASS_ODD), "color");
+        glDrawArrays(GL_TRIANGLE_FAN, firsts.back(), counts.back());
+        glDisable(GL_STENCIL_TEST);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        info.mipmapsValid = false;
+        applyFilteringMode();
+        return true;
+    }
 
-public:
     /**
-     * @brief Constructor for the PoincareTexture class.
-     * @param width The width of the texture.
-     * @param height The height of the texture.
+     * @brief Uploads the circles once into a texture buffer for the procedural fragment shader.
+     */
+    void uploadCircles() {
+        std::vector<vec4> packed;
+        for (const vec3 &circle : tiling.getCircles()) packed.emplace_back(circle.x, circle.y, circle.z * circle.z, 0.0f);
+        if (circleBuffer == 0) glGenBuffers(1, &circleBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, circleBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, packed.size() * sizeof(vec4), packed.data(), GL_STATIC_DRAW);
+        if (circleBufferTexture == 0) glGenTextures(1, &circleBufferTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, circleBufferTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, circleBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    /**
+     * @brief Binds the circle buffer and sets the uniforms of the procedural fragment shader.
+     * @param program The procedural GPU program, it must be in use.
+     * @param textureUnit The texture unit to bind the circle buffer to.
      */
-    PoincareTexture(int width, int height) : width(width), height(height) {
-        math();
-        auto im = RenderToTexture(width, height);
-        create(width, height, im);
+    void bindCircles(GPUProgram &program, unsigned int textureUnit) {
+        glActiveTexture(GL_TEXTURE0 + textureUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, circleBufferTexture);
+        glActiveTexture(GL_TEXTURE0);
+        program.setUniform(static_cast<int>(textureUnit), "circles");
+        program.setUniform(static_cast<int>(tiling.getCircles().size()), "circleCount");
     }
 
     /**
@@ -113,196 +1516,214 @@ public:
     void increaseResolution(int increaseBy) {
         width += increaseBy;
         height += increaseBy;
-        auto im = RenderToTexture(width, height);
-        create(width, height, im);
+        regenerate();
     }
 
     /**
      * @brief Sets the filtering mode of the texture.
-     * @param filteringMode The filtering mode to set.
+     * @param filteringMode GL_NEAREST, GL_LINEAR or GL_LINEAR_MIPMAP_LINEAR for trilinear filtering.
      */
     void setFilteringMode(GLenum filteringMode) {
-        glBindTexture(GL_TEXTURE_2D, textureId);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, static_cast<GLint>(filteringMode));
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, static_cast<GLint>(filteringMode));
+        this->filteringMode = filteringMode;
+        applyFilteringMode();
     }
 
     /**
-     * @brief Calculates the iv value.
-     * @param i The input value.
-     * @return The calculated iv value.
+     * @brief Sets the filtering mode of the texture object to the selected one.
      */
-    static vec3 calculateIv(int i) {
-        return {cosf(static_cast<float>((i * 40) * M_PI / 180)), sinf(static_cast<float>((i * 40) * M_PI / 180)), 0};
+    void applyFilteringMode() {
+        if (currentKey.generator == GENERATOR_DISTANCE) { // the distances are interpolated, the edges stay sharp
+            GLint minFilter = filteringMode == GL_NEAREST ? GL_LINEAR : static_cast<GLint>(filteringMode);
+            setFiltering(minFilter, GL_LINEAR, anisotropic ? maxAnisotropy() : 1.0f);
+            return;
+        }
+        if (currentKey.format == FORMAT_PALETTE) { // filtered by the fragment shader, see bind
+            setFiltering(GL_NEAREST, GL_NEAREST);
+            return;
+        }
+        GLint magFilter = filteringMode == GL_NEAREST ? GL_NEAREST : GL_LINEAR;
+        setFiltering(static_cast<GLint>(filteringMode), magFilter, anisotropic ? maxAnisotropy() : 1.0f);
     }
 
     /**
-     * @brief Calculates the ivv value.
-     * @param iv The iv value.
-     * @param dh The dh value.
-     * @return The calculated ivv value.
+     * @brief Turns anisotropic filtering with the largest supported anisotropy on or off.
+     * @param enabled True to filter anisotropically.
      */
-    static vec3 calculateIvv(const vec3& iv, float dh) {
-        return vec3(0,0,1)* sinh(dh) + iv * cosh(dh);
+    void setAnisotropic(bool enabled) {
+        anisotropic = enabled;
+        applyFilteringMode();
     }
 
     /**
-     * @brief Calculates the p value.
-     * @param ivv The ivv value.
-     * @param dh The dh value.
-     * @return The calculated p value.
+     * @brief Get the filtering mode selected with setFilteringMode.
+     * @return GL_NEAREST, GL_LINEAR or GL_LINEAR_MIPMAP_LINEAR.
      */
-    static vec3 calculateP(const vec3& ivv, float dh) {
-        return vec3(0, 0, 1) * cosh(dh) + ivv * sinh(dh);
-    }
+    GLenum getFilteringMode() const { return filteringMode; }
 
     /**
-     * @brief Calculates the h value.
+     * @brief Check whether the texture is filtered anisotropically.
+     * @return True if anisotropic filtering is on.
      */
-    void calcH(){
-        int i = 0;
-        while(i < 9){
-            vec3 iv = calculateIv(i);
-            float dh = 0.5;
-            while(dh <= 5.5){
-                vec3 ivv = calculateIvv(iv, dh);
-                vec3 p = calculateP(ivv, dh);
-                hyperbolicPoints.push_back(p);
-                dh ++;
-            }
-            i++;
-        }
-    }
+    bool isAnisotropic() const { return anisotropic; }
+
+};
+
+/**
+ * @brief The tilings cycled with the 'y' key, and the layers of the texture variants.
+ */
+const TilingSpec tilingPresets[] = {TilingSpec(), TilingSpec(5, 4, 4), TilingSpec(6, 4, 3), TilingSpec(4, 6, 3),
+                                    TilingSpec(7, 3, 5), TilingSpec(8, 3, 4)};
+const int tilingPresetCount = sizeof(tilingPresets) / sizeof(tilingPresets[0]);
+int currentTiling = 0; // the element of tilingPresets selected with the 'y' key
+
+/**
+ * @enum VariantFilter
+ * @brief The filterings of the texture variants, one sampler object and one texture unit each.
+ */
+enum VariantFilter {
+    VARIANT_NEAREST,     ///< Nearest texel.
+    VARIANT_LINEAR,      ///< Bilinear.
+    VARIANT_TRILINEAR,   ///< Trilinear, from the mipmaps.
+    VARIANT_ANISOTROPIC, ///< Trilinear with the largest supported anisotropy.
+    VARIANT_FILTER_COUNT ///< The number of filterings.
+};
+
+/**
+ * @class TextureVariants
+ * @brief The textures of every preset tiling, built once into the layers of an array texture.
+ *
+ * @details Every layer is rendered into 8-bit RGBA colours with a mipmap chain, and the array is bound to four
+ * texture units with a nearest, a linear, a trilinear and an anisotropic sampler object. variantFragmentSource picks
+ * the layer and the unit by uniform, so switching the tiling or the filtering changes two uniforms instead of
+ * regenerating, uploading or refiltering a texture.
+ */
+class TextureVariants {
+    TextureArray layers;                    ///< One layer per preset tiling.
+    Sampler samplers[VARIANT_FILTER_COUNT]; ///< The sampler objects of the filterings.
+    int layer = 0;                          ///< The layer shown.
+    VariantFilter filter = VARIANT_LINEAR;  ///< The filtering used.
+    double buildMs = 0;                     ///< The time the last build took.
+
+public:
+    static const unsigned int firstUnit = 4; ///< The first of the texture units, above those of the other modes.
+    static const size_t budget = 256 << 20;  ///< The most GPU memory the layers may take in bytes.
+
+    TextureVariants() = default;
+    TextureVariants(const TextureVariants &) = delete;
+    TextureVariants &operator=(const TextureVariants &) = delete;
 
     /**
-     * @brief Calculates the oszto value.
-     * @param point The point value.
-     * @return The calculated oszto value.
+     * @brief Renders the preset tilings into the layers, unless they are built at this size already.
+     * @param width The width of a layer.
+     * @param height The height of a layer.
+     * @param generator The CPU generator to render with, the stencil generator renders with the per-texel test.
+     * @return False if the layers would not fit into the budget or the driver's layer limit.
      */
-    static float calculateOszto(const vec3& point) {
-        return point.z + 1;
+    bool build(int width, int height, TextureGenerator generator) {
+        if (layers.textureId != 0 && layers.info.width == width && layers.info.height == height) return true;
+        TRACE_ZONE("TextureVariants::build");
+        size_t bytes = (size_t)width * height * 4 * 4 / 3 * tilingPresetCount;
+        if (bytes > budget || tilingPresetCount > TextureArray::maxLayers()) {
+            printf("%d texture variants of %dx%d take %.0f MB, more than the budget of %.0f MB\n", tilingPresetCount,
+                   width, height, static_cast<double>(bytes) / (1 << 20), static_cast<double>(budget) / (1 << 20));
+            return false;
+        }
+        double start = timestampMs();
+        layers.allocate(width, height, tilingPresetCount, GL_RGBA8, true);
+        std::vector<unsigned char> texels((size_t)width * height * 4);
+        for (int i = 0; i < tilingPresetCount; i++) {
+            PoincareGenerator tiling(workerPool, tilingPresets[i]);
+            tiling.renderTexels(width, 0, height, generator, TEXELS_RGBA8, texels.data(), [] { return false; });
+            layers.update(i, 0, 0, width, height, texels.data());
+        }
+        layers.generateMipmaps();
+        samplers[VARIANT_NEAREST].create(GL_NEAREST, GL_NEAREST);
+        samplers[VARIANT_LINEAR].create(GL_LINEAR, GL_LINEAR);
+        samplers[VARIANT_TRILINEAR].create(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR);
+        samplers[VARIANT_ANISOTROPIC].create(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, Texture::maxAnisotropy());
+        buildMs = timestampMs() - start;
+        printf("Built %d texture variants of %dx%d in %.1f ms, %.1f MB\n", tilingPresetCount, width, height, buildMs,
+               static_cast<double>(layers.bytes()) / (1 << 20));
+        return true;
     }
 
     /**
-     * @brief Adds a Poincare point.
-     * @param point The point to add.
-     * @param oszto The oszto value.
+     * @brief Sets the texture units of the sampler uniforms, once after the program is linked.
+     * @param program The variant GPU program, it must be in use.
      */
-    void addPP(const vec3& point, float oszto) {
-        poincarePoints.emplace_back((point.x / oszto), (point.y / oszto));
+    static void setUnits(GPUProgram &program) {
+        for (int i = 0; i < VARIANT_FILTER_COUNT; i++)
+            program.setUniform(static_cast<int>(firstUnit) + i, "variants[" + std::to_string(i) + "]");
     }
 
     /**
-     * @brief Calculates the p value.
+     * @brief Selects the layer shown.
+     * @param index The element of tilingPresets.
      */
-    void calcP(){
-        auto it = hyperbolicPoints.begin();
-        while(it != hyperbolicPoints.end()) {
-            float oszto = calculateOszto(*it);
-            addPP(*it, oszto);
-            ++it;
-        }
-    }
+    void setLayer(int index) { layer = index; }
 
     /**
-     * @brief Calculates the r value.
-     * @param point The point value.
-     * @return The calculated r value.
+     * @brief Selects the filtering of a PoincareTexture filtering mode.
+     * @param filteringMode GL_NEAREST, GL_LINEAR or GL_LINEAR_MIPMAP_LINEAR.
+     * @param anisotropic True to filter anisotropically on top of the trilinear filtering.
      */
-    static float calculateR(const vec2& point) {
-        return (1/(sqrtf(powf(point.x, 2)+powf(point.y, 2)))-(sqrtf(powf(point.x, 2)+powf(point.y, 2))))/2;
+    void setFilter(GLenum filteringMode, bool anisotropic) {
+        if (filteringMode == GL_NEAREST) filter = VARIANT_NEAREST;
+        else if (filteringMode == GL_LINEAR) filter = VARIANT_LINEAR;
+        else filter = anisotropic ? VARIANT_ANISOTROPIC : VARIANT_TRILINEAR;
     }
 
     /**
-     * @brief Calculates the c value.
+     * @brief Get the PoincareTexture filtering mode of the filtering used.
+     * @return GL_NEAREST, GL_LINEAR or GL_LINEAR_MIPMAP_LINEAR.
      */
-    void calcC(){
-        auto it = poincarePoints.begin();
-        while(it != poincarePoints.end()) {
-            float r = calculateR(*it);
-            vec2 i = normalize(*it);
-            vec2 origo = *it+i*r;
-            circles.emplace_back(origo.x, origo.y, r);
-            ++it;
-        }
+    GLenum getFilteringMode() const {
+        return filter == VARIANT_NEAREST ? GL_NEAREST : filter == VARIANT_LINEAR ? GL_LINEAR : GL_LINEAR_MIPMAP_LINEAR;
     }
+
     /**
-     * @brief Calculates the distance value.
-     * @param point The point value.
-     * @param circle The circle value.
-     * @return The calculated distance value.
+     * @brief Check whether the variants are filtered anisotropically.
+     * @return True if the anisotropic sampler is used.
      */
-    static float calculateDistance(const vec2& point, const vec3& circle) {
-        return sqrtf(powf(point.x-circle.x, 2)+powf(point.y-circle.y, 2));
-    }
+    bool isAnisotropic() const { return filter == VARIANT_ANISOTROPIC; }
 
     /**
-     * @brief Counts the number of circles.
-     * @param point The point value.
-     * @return The number of circles.
+     * @brief Binds the layers and the sampler objects and sets the uniforms that select the variant.
+     * @param program The variant GPU program, it must be in use.
      */
-    int countCircles(const vec2& point){
-        int count = 0;
-        auto it = circles.begin();
-        while(it != circles.end()) {
-            if(calculateDistance(point, *it) <= it->z){
-                count++;
-            }
-            ++it;
+    void bind(GPUProgram &program) {
+        for (int i = 0; i < VARIANT_FILTER_COUNT; i++) {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, layers.textureId);
+            samplers[i].bind(firstUnit + i);
         }
-        return count;
+        glActiveTexture(GL_TEXTURE0);
+        program.setUniform(static_cast<int>(filter), "variantFilter");
+        program.setUniform(static_cast<float>(layer), "variantLayer");
     }
 
     /**
-     * @brief Returns the number of circles.
-     * @param point The point value.
-     * @return The number of circles.
+     * @brief Get the GPU memory of the layers.
+     * @return The size of the layers in bytes.
      */
-    int manyCircles(vec2 point){
-        return countCircles(point);
-    }
+    size_t bytes() const { return layers.bytes(); }
 
     /**
-     * @brief Performs the math operations.
+     * @brief Formats the state of the variants for the overlay.
+     * @return The layer, the filtering and the size of the layers.
      */
-    void math(){
-        calcH();
-        calcP();
-        calcC();
-    }
-
-    /**
-    * @brief Renders the texture.
-    * @param textureWidth The width of the texture.
-    * @param textureHeight The height of the texture.
-    * @return The rendered texture.
-    */
-    std::vector<vec4> RenderToTexture(int textureWidth, int textureHeight) {
-        std::vector<vec4> textureData;
-        int yC = 0;
-        while(yC < textureHeight) {
-            int xC = 0;
-            while(xC < textureWidth) {
-                float x =(float) xC / (float)textureWidth * 2 - 1.0f;
-                float y =(float) yC / (float)textureWidth * 2 - 1.0f;
-                int count = manyCircles(vec2(x, y));
-                if(sqrt(pow(x, 2) + pow(y, 2)) > 1) {
-                    textureData.emplace_back(0.0f, 0.0f, 0.0f, 1.0f);
-                }
-                else if(count % 2 == 0) {
-                    textureData.emplace_back(1.0f, 1.0f, 0.0f, 1.0f);
-                }
-                else {
-                    textureData.emplace_back(0.0f, 0.0f, 1.0f, 1.0f);
-                }
-                xC++;
-            }
-            yC++;
-        }
-        return textureData;
+    std::string describe() const {
+        static const char *filterNames[VARIANT_FILTER_COUNT] = {"nearest", "linear", "trilinear", "anisotropic"};
+        char line[128];
+        snprintf(line, sizeof(line), "variant %d of %d (%s), %s sampler, %dx%d layers built in %.1f ms", layer + 1,
+                 layers.layers, tilingPresets[layer].name().c_str(), filterNames[filter], layers.info.width,
+                 layers.info.height, buildMs);
+        return line;
     }
 };
 
+TextureVariants textureVariants; // the preset tilings in one array texture, shown with the 'n' key
+
 /**
  * @struct VertexData
  * @brief A structure to hold vertex data.
@@ -323,13 +1744,18 @@ struct VertexData {
 class Star {
 public:
     unsigned int vao{}; ///< Vertex array object.
-    unsigned int vbo[2]{}; ///< Vertex buffer objects.
+    StreamingVertexBuffer vertices; ///< The interleaved positions and texture coordinates of data.
     VertexData data[10]; ///< Array of vertex data.
     PoincareTexture texture; ///< Poincare texture of the star.
     vec3 starCenter = vec3(50, 30, 0); ///< Center of the star.
     vec3 circleCenter = vec3(20, 30, 0.0f); ///< Center of the circle.
     float phi{}; ///< Angle for rotation.
     float selfRotation{}; ///< Angle for self rotation.
+    float time{}; ///< Time parameter of the last animation step.
+    bool breathing = false; ///< Animate the thinness of the star too.
+    float breath{}; ///< The part of the thinness applied by the breathing animation.
+    UniformHandle modelUniform[4]; ///< The model matrix uniform of the programs of Draw, by their shading index.
+    TextureUniforms textureUniforms; ///< The texture uniforms of gpuProgram.
 
 public:
     /**
@@ -355,19 +1781,13 @@ public:
         glGenVertexArrays(1, &vao);    // create 1 vertex array object
         glBindVertexArray(vao);        // make it active
 
-        glGenBuffers(2, vbo);    // Generate 2 vertex buffer objects
+        vertices.create(data, sizeof(data), sizeof(VertexData)); // one interleaved buffer for both attributes
 
-        // vertex coordinates: vbo[0] -> Attrib Array 0 of the vertex shader
-        glBindBuffer(GL_ARRAY_BUFFER, vbo[0]); // make it active, it is an array
-        glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_DYNAMIC_DRAW);
+        // positions -> Attrib Array 0, texture coordinates -> Attrib Array 1 of the vertex shader
         glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData),(void *) nullptr);     // stride and offset: it is tightly packed
-
-        // texture coordinates: vbo[1] -> Attrib Array 1 of the vertex shader
-        glBindBuffer(GL_ARRAY_BUFFER, vbo[1]); // make it active, it is an array
-        glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_DYNAMIC_DRAW);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData),(void *) nullptr);
         glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData),(void *) sizeof(vec2));     // stride and offset: it is tightly packed
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData),(void *) sizeof(vec2));
     }
 
     /**
@@ -388,14 +1808,33 @@ public:
     }
 
     /**
-     * @brief Draw the star.
+     * @brief Resolve the uniforms the star sets in every frame, once the programs are created.
+     */
+    void resolveUniforms() {
+        modelUniform[0] = gpuProgram.getUniform("M");
+        modelUniform[1] = proceduralProgram.getUniform("M");
+        modelUniform[2] = virtualProgram.getUniform("M");
+        modelUniform[3] = variantProgram.getUniform("M");
+        gpuProgram.Use();
+        textureUniforms.resolve(gpuProgram);
+    }
+
+    /**
+     * @brief Draw the star, the View-Projection matrix is taken from frameUniforms.
      */
     void Draw() {
-        mat4 MVPTransform = M()* camera.V() * camera.P();
-        gpuProgram.setUniform(MVPTransform, "MVP");
-        glBindTexture(GL_TEXTURE_2D, texture.textureId);
+        int shading = proceduralMode ? 1 : virtualMode ? 2 : variantMode ? 3 : 0;
+        GPUProgram *programs[4] = {&gpuProgram, &proceduralProgram, &virtualProgram, &variantProgram};
+        GPUProgram &program = *programs[shading];
+        program.Use();
+        program.setUniform(M(), modelUniform[shading]);
+        if (shading == 1) texture.bindCircles(program, 1);
+        else if (shading == 2) virtualTexture->bind(program, 1);
+        else if (shading == 3) textureVariants.bind(program);
+        else texture.bind(program, textureUniforms);
         glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLE_FAN, 0, 10);
+        glDrawArrays(GL_TRIANGLE_FAN, vertices.firstVertex(), 10);
+        vertices.drawn();
     }
 
     /**
@@ -405,17 +1844,74 @@ public:
     */
     void Animate(float t) {
         float rotationSpeed = 2.0f * M_PI / 10.0f;
+        time = t;
         phi = t * rotationSpeed;
         selfRotation = t * rotationSpeed;
+        if (breathing) {
+            float target = 8 * sinf(t * rotationSpeed * 3);
+            schlankheitsfaktor(target - breath); // streams the vertices in every frame
+            breath = target;
+        }
+    }
+
+    /**
+     * @brief Turn the breathing animation of the thinness on or off.
+     *
+     * @param on True to animate the thinness.
+     */
+    void setBreathing(bool on) {
+        breathing = on;
+        if (on) return;
+        schlankheitsfaktor(-breath);
+        breath = 0;
     }
 
+    /**
+     * @brief Get the animation time of the star.
+     *
+     * @return The time last passed to Animate in seconds.
+     */
+    float getTime() const { return time; }
+
     /**
      * @brief Get the model matrix for the star.
      *
      * @return The model matrix for the star.
      */
-    mat4 M() const {
-        return TranslateMatrix(-starCenter) * RotationMatrix(selfRotation, vec3(0, 0, 1)) * TranslateMatrix(starCenter) * TranslateMatrix(-circleCenter) * RotationMatrix(phi, vec3(0.0f, 0.0f, 1.0f)) * TranslateMatrix(circleCenter);
+    mat4 M() const { return modelTransform().toMat4(); }
+
+    /**
+     * @brief Get the model transformation of the star.
+     *
+     * @return The self rotation about the star centre, then the orbit about the circle centre, composed in closed form.
+     */
+    affine2 modelTransform() const {
+        return affine2::rotationAbout(selfRotation, vec2(starCenter.x, starCenter.y)) *
+               affine2::rotationAbout(phi, vec2(circleCenter.x, circleCenter.y));
+    }
+
+    /**
+     * @brief Find the texture coordinates the camera sees on the star and the detail they need.
+     *
+     * @param camera The camera.
+     * @param uvMin The lower left corner of the visible texture coordinates.
+     * @param uvMax The upper right corner of the visible texture coordinates.
+     * @param pixelsPerUv The pixels of a unit step in texture coordinates, along the direction it is longest.
+     * @return False if the star is out of the view.
+     */
+    bool visibleUv(const Camera2D &camera, vec2 &uvMin, vec2 &uvMax, float &pixelsPerUv) const {
+        vec2 positions[10], uvs[10];
+        for (int i = 0; i < 10; i++) {
+            positions[i] = data[i].position;
+            uvs[i] = data[i].uv;
+        }
+        transformPoints(modelTransform(), positions, positions, 10);
+        vec2 half = camera.getSize() * 0.5f;
+        float worldPerUv;
+        if (!visibleFanBounds(positions, uvs, 10, camera.getCenter() - half, camera.getCenter() + half, uvMin, uvMax,
+                              worldPerUv)) return false;
+        pixelsPerUv = worldPerUv * windowWidth / camera.getSize().x;
+        return true;
     }
 
 
@@ -440,39 +1936,319 @@ public:
             }
             ++it;
         }
-        glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_DYNAMIC_DRAW); // copy to that part of the memory which is modified
+        vertices.update(data); // no reallocation, and the ring does not wait for the previous draw calls
     }
 };
 
 Star *star;
 
+/**
+ * @struct StarInstance
+ * @brief The per-instance data of the star field, attribute 2 of starFieldVertexSource.
+ */
+struct StarInstance {
+    vec2 center;     ///< The centre of the instance in world coordinates.
+    float phase;     ///< The animation phase in radians.
+    float thinness;  ///< The schlankheitsfaktor of the instance, added to the one of the shared star.
+};
+
+/**
+ * @class StarField
+ * @brief Many copies of the star drawn with one instanced draw call.
+ *
+ * The instances share the vertex buffer and the PoincareTexture of the star, their centres, phases and thinness
+ * are in an instance buffer, and the animation runs in the vertex shader.
+ */
+class StarField {
+    unsigned int vao = 0;         ///< Vertex array object.
+    unsigned int instanceVbo = 0; ///< The buffer of the StarInstance records.
+    int count = 0;                ///< The number of instances.
+    float scale = 1;              ///< The size of an instance relative to the star.
+    UniformHandle timeUniform[2]; ///< The time uniform of the texture and of the procedural program.
+    UniformHandle scaleUniform[2]; ///< The instance size uniform of the texture and of the procedural program.
+    TextureUniforms textureUniforms; ///< The texture uniforms of program.
+
+public:
+    GPUProgram program;           ///< The star field vertex shader with the texture fragment shader.
+    GPUProgram proceduralProgram; ///< The star field vertex shader with the procedural fragment shader.
+
+    StarField() = default;
+    StarField(const StarField &) = delete;
+    StarField &operator=(const StarField &) = delete;
+
+    /**
+     * @brief Start compiling the programs, create finishes them.
+     */
+    void compilePrograms() {
+        program.compile(starFieldVertexSource, fragmentSource, "fragmentColor");
+        proceduralProgram.compile(starFieldVertexSource, proceduralFragmentSource, "fragmentColor");
+    }
+
+    /**
+     * @brief Create the programs and the vertex array on the vertex buffer of the star.
+     * @param star The star whose vertices and texture are shared.
+     * @param frameDataBinding The uniform buffer binding point of the FrameData block.
+     */
+    void create(const Star &star, unsigned int frameDataBinding) {
+        program.finish();
+        proceduralProgram.finish();
+        GPUProgram *programs[2] = {&program, &proceduralProgram};
+        for (int i = 0; i < 2; i++) {
+            programs[i]->Use();
+            programs[i]->bindUniformBlock("FrameData", frameDataBinding);
+            programs[i]->setUniform(vec2(star.starCenter.x, star.starCenter.y), "starCenter");
+            programs[i]->setUniform(vec2(star.circleCenter.x, star.circleCenter.y), "circleCenter");
+            timeUniform[i] = programs[i]->getUniform("time");
+            scaleUniform[i] = programs[i]->getUniform("starScale");
+        }
+        program.Use();
+        textureUniforms.resolve(program);
+
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, star.vertices.getId());
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void *) nullptr);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void *) sizeof(vec2));
+        glGenBuffers(1, &instanceVbo);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), (void *) nullptr);
+        glVertexAttribDivisor(2, 1); // advance once per instance
+    }
+
+    /**
+     * @brief Scatter a number of instances over the camera window.
+     * @param instances The number of instances, 0 turns the field off.
+     */
+    void populate(int instances) {
+        count = instances;
+        if (count == 0) return;
+        vec2 center = camera.getCenter(), size = camera.getSize();
+        int columns = static_cast<int>(ceilf(sqrtf(static_cast<float>(count))));
+        vec2 cell(size.x / columns, size.y / columns);
+        scale = std::min(cell.x, cell.y) / 80; // the star is 80 units wide
+        std::mt19937 random(count);
+        std::uniform_real_distribution<float> unit(0, 1);
+        std::vector<StarInstance> instanceData(count);
+        for (int i = 0; i < count; i++) {
+            vec2 jitter(unit(random) - 0.5f, unit(random) - 0.5f);
+            instanceData[i].center = center - size * 0.5f +
+                                     vec2(cell.x * (i % columns + 0.5f + jitter.x), cell.y * (i / columns + 0.5f + jitter.y));
+            instanceData[i].phase = unit(random) * 2 * static_cast<float>(M_PI);
+            instanceData[i].thinness = (unit(random) - 0.5f) * 20;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+        glBufferData(GL_ARRAY_BUFFER, instanceData.size() * sizeof(StarInstance), instanceData.data(), GL_STATIC_DRAW);
+    }
+
+    /**
+     * @brief Get the number of instances.
+     * @return The number of instances, 0 if the field is off.
+     */
+    int getCount() const { return count; }
+
+    /**
+     * @brief Draw all instances with one draw call.
+     * @param star The star whose vertices, texture and animation time are shared.
+     */
+    void Draw(Star &star) {
+        PoincareTexture &texture = star.getTexture();
+        GPUProgram &fieldProgram = proceduralMode ? proceduralProgram : program;
+        fieldProgram.Use();
+        fieldProgram.setUniform(star.getTime(), timeUniform[proceduralMode ? 1 : 0]);
+        fieldProgram.setUniform(scale, scaleUniform[proceduralMode ? 1 : 0]);
+        if (proceduralMode) texture.bindCircles(fieldProgram, 1);
+        else texture.bind(fieldProgram, textureUniforms);
+        glBindVertexArray(vao);
+        glDrawArraysInstanced(GL_TRIANGLE_FAN, star.vertices.firstVertex(), 10, count);
+        star.vertices.drawn();
+    }
+
+    /**
+     * @brief Destructor.
+     */
+    ~StarField() {
+        if (instanceVbo != 0) glDeleteBuffers(1, &instanceVbo);
+        if (vao != 0) glDeleteVertexArrays(1, &vao);
+    }
+};
+
+StarField starField; // instanced copies of the star, cycled with the 'm' key
+PerformanceHud hud; // frame statistics shown with the 'i' key
+void onIdle();
+void onPollTimer(int value);
+FrameScheduler scheduler(onIdle, onPollTimer); // redraws on changes only, paced while animating
+bool isAnimating = false;
+FrameCapture frameCapture; // records the animation on a fixed timestep, toggled with 'k'
+PacingMode pacingBeforeCapture = PACING_60_FPS; // restored when the capture stops
+
 /**
  * @brief Initializes the OpenGL viewport and creates a new Star object.
  *
  * This function sets the OpenGL viewport, creates a new Star object with a specified width and height, and creates a GPU program.
  */
 void onInitialization() {
+    TraceRecorder::instance().nameThread("main");
     glViewport(0, 0, windowWidth, windowHeight);
+    workerPool.setThreadCount(static_cast<int>(std::thread::hardware_concurrency()));
     int width = 300, height = 300;
+    double start = timestampMs();
+    // the driver compiles the programs that are not in the binary cache while the first texture is generated
+    proceduralProgram.compile(vertexSource, proceduralFragmentSource, "fragmentColor");
+    gpuProgram.compile(vertexSource, fragmentSource, "fragmentColor");
+    virtualProgram.compile(vertexSource, virtualFragmentSource, "fragmentColor");
+    variantProgram.compile(vertexSource, variantFragmentSource, "fragmentColor");
+    starField.compilePrograms();
     star = new Star(width, height);
-    gpuProgram.create(vertexSource, fragmentSource, "fragmentColor");
+    proceduralProgram.finish();
+    gpuProgram.finish();
+    virtualProgram.finish();
+    variantProgram.finish();
+    frameUniforms.create(sizeof(FrameData), frameDataBinding);
+    proceduralProgram.bindUniformBlock("FrameData", frameDataBinding);
+    gpuProgram.bindUniformBlock("FrameData", frameDataBinding);
+    virtualProgram.bindUniformBlock("FrameData", frameDataBinding);
+    variantProgram.bindUniformBlock("FrameData", frameDataBinding);
+    variantProgram.Use();
+    TextureVariants::setUnits(variantProgram);
+    star->resolveUniforms();
+    starField.create(*star, frameDataBinding);
+    int cached = 0;
+    for (GPUProgram *program : {&proceduralProgram, &gpuProgram, &virtualProgram, &variantProgram, &starField.program,
+                                &starField.proceduralProgram}) cached += program->fromBinaryCache() ? 1 : 0;
+    printf("Initialized in %.1f ms, %d of 6 programs from the binary cache\n", timestampMs() - start, cached);
+    scheduler.setPacing(PACING_60_FPS);
+    scheduler.setContinuous(false);
+}
+
+/**
+ * @brief Get the lines about the texture shown by the performance overlay.
+ * @return The lines.
+ */
+std::vector<std::string> textureStatistics() {
+    PoincareTexture &texture = star->getTexture();
+    char line[128];
+    std::vector<std::string> lines;
+    snprintf(line, sizeof(line), "texture %dx%d %s %s, last regeneration %.1f ms", texture.getWidth(),
+             texture.getHeight(), textureGeneratorName(texture.getGenerator()), texelFormatName(texture.getFormat()),
+             texture.getLastRegenerationMs());
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "tiling %s, %d circles", texture.getTiling().name().c_str(), texture.getCircleCount());
+    lines.push_back(line);
+    if (starField.getCount() > 0) {
+        snprintf(line, sizeof(line), "star field %d instances in one draw call", starField.getCount());
+        lines.push_back(line);
+    }
+    if (virtualMode) {
+        double tileMs;
+        unsigned long generated = virtualTexture->getGeneratedTiles(tileMs);
+        snprintf(line, sizeof(line), "virtual texture zoom %gx, level %d, %d/%d visible tiles from a coarser level",
+                 camera.getMagnification(), virtualTexture->getLevel(), virtualTexture->getFallbackTiles(),
+                 virtualTexture->getVisibleTiles());
+        lines.push_back(line);
+        snprintf(line, sizeof(line), "atlas %d/%d tiles, %lu generated (last %.2f ms), %lu evicted",
+                 virtualTexture->residentCount(), VirtualTexture::atlasColumns * VirtualTexture::atlasColumns,
+                 generated, tileMs, virtualTexture->getEvictions());
+        lines.push_back(line);
+    }
+    if (variantMode) lines.push_back(textureVariants.describe());
+    size_t virtualBytes = virtualTexture ? virtualTexture->residentBytes() : 0;
+    snprintf(line, sizeof(line), "resident texture memory %.1f MB",
+             static_cast<double>(texture.residentBytes() + virtualBytes + textureVariants.bytes()) / (1024 * 1024));
+    lines.push_back(line);
+    lines.push_back(scheduler.describe());
+    if (frameCapture.isActive()) lines.push_back(frameCapture.describe());
+    return lines;
+}
+
+/**
+ * @brief Checks on the texture work running on other threads or spread over frames, and asks for a redraw when
+ * it has news.
+ *
+ * @return True while there is work left, false once the texture is complete.
+ */
+bool pollBackgroundWork() {
+    PoincareTexture &texture = star->getTexture();
+    if (texture.refine() || texture.pumpUploads() || texture.hasBackgroundResult()) scheduler.invalidate(DIRTY_TEXTURE);
+    bool tilesPending = virtualMode && virtualTexture->busy();
+    if (tilesPending) scheduler.invalidate(DIRTY_TEXTURE); // a frame uploads the tiles and requests the next ones
+    return texture.isBusy() || tilesPending;
 }
 
 /**
  * @brief Handles the display event.
  *
- * This function clears the screen, draws the star, and swaps the buffers.
+ * This function brings the state the scheduler marked dirty up to date: it swaps in a texture finished in the
+ * background, requests the visible tiles of the virtual texture and writes the View-Projection matrix. Then it
+ * clears the screen, draws the star and the performance overlay, and swaps the buffers. If work on the texture is
+ * still going on, it is polled until it is finished.
  */
 void onDisplay() {
+    TRACE_ZONE("onDisplay");
+    double start = timestampMs();
+    unsigned int changes = scheduler.frameStarted();
+    hud.frameStarted();
+    bool timed = hud.isVisible();
+    if (timed) hud.uploadPass.begin();
+    if (changes & DIRTY_TEXTURE) star->getTexture().swapIfReady(); // pollBackgroundWork marks a finished texture
+    if ((changes & (DIRTY_STAR | DIRTY_TEXTURE | DIRTY_CAMERA)) && virtualMode && !proceduralMode &&
+        starField.getCount() == 0) {
+        vec2 uvMin(1, 1), uvMax(0, 0);
+        float pixelsPerUv = 0;
+        star->visibleUv(camera, uvMin, uvMax, pixelsPerUv);
+        virtualTexture->update(uvMin, uvMax, pixelsPerUv);
+    }
+    if (timed) hud.uploadPass.end();
+    if (frameCapture.isActive()) star->Animate(frameCapture.frameTime()); // one fixed timestep per captured frame
     glClearColor(0, 0, 0, 0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // clear the screen
-    star->Draw();
-    glutSwapBuffers();                                    // exchange the two buffers
+    if (changes & DIRTY_CAMERA) {
+        FrameData frame;
+        frame.VP = camera.V() * camera.P();
+        frameUniforms.update(&frame, sizeof(frame));
+    }
+    if (timed) hud.starPass.begin();
+    if (starField.getCount() > 0) starField.Draw(*star);
+    else star->Draw();
+    if (timed) hud.starPass.end();
+    if (frameCapture.isActive()) frameCapture.capture(); // without the overlay
+    hud.draw(textureStatistics());
+    {
+        TRACE_ZONE("glutSwapBuffers"); // waits for the GPU or the display when the driver queues too many frames
+        glutSwapBuffers();                                // exchange the two buffers
+    }
+    if (star->getTexture().isBusy() || (virtualMode && virtualTexture->busy())) scheduler.watch();
+    hud.displayTime.add(timestampMs() - start);
 }
 
-bool isAnimating = false;
-long time;
+
+/**
+ * @brief Selects the tiling of the texture and of the virtual texture.
+ * @param spec The tiling.
+ */
+void selectTiling(const TilingSpec &spec) {
+    PoincareTexture &texture = star->getTexture();
+    texture.setTiling(spec);
+    if (virtualTexture) virtualTexture->setTiling(spec);
+    verbosePrintf("Tiling: %s, %d circles\n", texture.getTiling().name().c_str(), texture.getCircleCount());
+}
+
+/**
+ * @brief Selects the filtering of the texture and of the texture variants.
+ *
+ * @details While the variants are shown only their sampler changes, the texture follows when they are left.
+ *
+ * @param filteringMode GL_NEAREST, GL_LINEAR or GL_LINEAR_MIPMAP_LINEAR.
+ * @param anisotropic True to filter anisotropically on top of the filtering mode.
+ */
+void selectFiltering(GLenum filteringMode, bool anisotropic) {
+    textureVariants.setFilter(filteringMode, anisotropic);
+    if (variantMode) return;
+    star->getTexture().setAnisotropic(anisotropic);
+    star->getTexture().setFilteringMode(filteringMode);
+}
 
 /**
  * @brief Handles the keyboard press event.
@@ -484,29 +2260,142 @@ long time;
  * @param pY The y-coordinate of the mouse pointer when the key was pressed.
  */
 void onKeyboard(unsigned char key, int pX, int pY) {
+    TRACE_ZONE("onKeyboard");
     if (key == 'h') {
         star->schlankheitsfaktor(-10);
-        glutPostRedisplay();
+        scheduler.invalidate(DIRTY_STAR);
     } else if (key == 'H') {
         star->schlankheitsfaktor(10);
-        glutPostRedisplay();
+        scheduler.invalidate(DIRTY_STAR);
     } else if (key == 'a') {
-        time = glutGet(GLUT_ELAPSED_TIME);
+        scheduler.resetAnimationClock();
         isAnimating = !isAnimating;
+    } else if (key == 'b') {
+        star->setBreathing(!star->breathing);
+        verbosePrintf("Breathing %s, vertices streamed with %s\n", star->breathing ? "on" : "off",
+                      star->vertices.persistent() ? "a persistent-mapped ring" : "glBufferSubData");
+        scheduler.invalidate(DIRTY_STAR);
+    } else if (key == 'p') {
+        proceduralMode = !proceduralMode;
+        verbosePrintf("%s mode\n", proceduralMode ? "Procedural" : "Texture");
+        scheduler.invalidate(DIRTY_STAR);
+    } else if (key == 'g') {
+        PoincareTexture &texture = star->getTexture();
+        texture.setGenerator(static_cast<TextureGenerator>((texture.getGenerator() + 1) % GENERATOR_COUNT));
+        verbosePrintf("Texture generator: %s\n", textureGeneratorName(texture.getGenerator()));
+        scheduler.invalidate(DIRTY_TEXTURE);
+    } else if (key == 'c') {
+        PoincareTexture &texture = star->getTexture();
+        texture.setFormat(static_cast<TexelFormat>((texture.getFormat() + 1) % FORMAT_COUNT));
+        verbosePrintf("Texture format: %s\n", texelFormatName(texture.getFormat()));
+        scheduler.invalidate(DIRTY_TEXTURE);
+    } else if (key == 'm') {
+        int instances = starField.getCount() == 0 ? 10000 : starField.getCount() == 10000 ? 100000 : 0;
+        starField.populate(instances);
+        if (instances == 0) verbosePrintf("Star field off\n");
+        else verbosePrintf("Star field: %d instances\n", instances);
+        scheduler.invalidate(DIRTY_STAR);
+    } else if (key == 'w') {
+        if (!virtualTexture) virtualTexture = new VirtualTexture(workerPool, star->getTexture().getTiling());
+        virtualMode = !virtualMode;
+        verbosePrintf("%s\n", virtualMode ? "Virtual texture mode, tiles generated for the view" : "Texture mode");
+        scheduler.invalidate(DIRTY_TEXTURE);
+    } else if (key == 'z' || key == 'Z') {
+        camera.zoom(key == 'z' ? 2.0f : 0.5f, camera.windowToWorld(pX, pY));
+        verbosePrintf("Zoom: %gx\n", camera.getMagnification());
+        scheduler.invalidate(DIRTY_CAMERA);
+    } else if (key == 'y' && variantMode) {
+        currentTiling = (currentTiling + 1) % tilingPresetCount;
+        textureVariants.setLayer(currentTiling); // the texture follows when the variants are left
+        verbosePrintf("Texture variant: %s\n", tilingPresets[currentTiling].name().c_str());
+        scheduler.invalidate(DIRTY_TEXTURE);
+    } else if (key == 'y') {
+        currentTiling = (currentTiling + 1) % tilingPresetCount;
+        selectTiling(tilingPresets[currentTiling]);
+        scheduler.invalidate(DIRTY_TEXTURE);
+    } else if (key == 'n') {
+        PoincareTexture &texture = star->getTexture();
+        if (!variantMode && textureVariants.build(texture.getWidth(), texture.getHeight(), texture.getGenerator())) {
+            textureVariants.setLayer(currentTiling);
+            textureVariants.setFilter(texture.getFilteringMode(), texture.isAnisotropic());
+            variantMode = true;
+            verbosePrintf("Texture variants: 'y' and the filtering keys switch layers and samplers, no upload\n");
+        } else if (variantMode) {
+            variantMode = false;
+            selectFiltering(textureVariants.getFilteringMode(), textureVariants.isAnisotropic());
+            if (!(texture.getTiling() == tilingPresets[currentTiling])) selectTiling(tilingPresets[currentTiling]);
+            verbosePrintf("Texture mode\n");
+        }
+        scheduler.invalidate(DIRTY_TEXTURE);
+    } else if (key == 'k') {
+        if (!frameCapture.isActive()) {
+            pacingBeforeCapture = scheduler.getPacing();
+            scheduler.setPacing(PACING_UNLIMITED); // the fixed timestep does not depend on the frame rate
+            frameCapture.start(windowWidth, windowHeight, "capture", 60, star->getTime());
+            printf("Capturing frames at a fixed 60 fps timestep to capture/\n");
+        } else {
+            frameCapture.stop();
+            scheduler.setPacing(pacingBeforeCapture);
+            scheduler.resetAnimationClock(star->getTime()); // continue from the last captured frame
+        }
+        scheduler.invalidate(DIRTY_STAR);
+    } else if (key == 'd') {
+        TraceRecorder &recorder = TraceRecorder::instance();
+        if (recorder.enabled) {
+            recorder.stop();
+            printf("Tracing stopped, 'D' writes the session to trace.json\n");
+        } else {
+            recorder.start();
+            printf("Tracing started\n");
+        }
+    } else if (key == 'D') {
+        long events = TraceRecorder::instance().write("trace.json");
+        if (events >= 0) printf("Wrote %ld trace events to trace.json, open it in ui.perfetto.dev or chrome://tracing\n", events);
+    } else if (key == 'o') {
+        verbose = !verbose;
+        printf("Verbose console output %s\n", verbose ? "on" : "off");
+    } else if (key == 'i') {
+        hud.toggle();
+        scheduler.invalidate(DIRTY_OVERLAY);
+    } else if (key == 'l') {
+        PacingMode mode = static_cast<PacingMode>((scheduler.getPacing() + 1) % PACING_COUNT);
+        if (!scheduler.setPacing(mode)) printf("The swap interval cannot be set, pacing at 60 fps instead\n");
+        verbosePrintf("Frame pacing: %s\n", pacingModeName(scheduler.getPacing()));
+        scheduler.invalidate(DIRTY_OVERLAY);
+    } else if (key == 's') {
+        PoincareTexture &texture = star->getTexture();
+        int samples = texture.getAntialiasSamples() >= 8 ? 1 : texture.getAntialiasSamples() * 2;
+        texture.setAntialiasSamples(samples);
+        if (samples == 1) verbosePrintf("Anti-aliasing off\n");
+        else verbosePrintf("Anti-aliasing: %dx%d subsamples on the edges\n", samples, samples);
+        scheduler.invalidate(DIRTY_TEXTURE);
+    } else if (key == 'v') {
+        PoincareTexture &texture = star->getTexture();
+        texture.setRegenerationMode(static_cast<RegenerationMode>((texture.getRegenerationMode() + 1) % REGENERATE_COUNT));
+        verbosePrintf("Regeneration mode: %s\n", regenerationModeName(texture.getRegenerationMode()));
+        scheduler.invalidate(DIRTY_TEXTURE);
+    } else if (proceduralMode && (key == 'r' || key == 'R')) {
+        verbosePrintf("The procedural mode is always at screen resolution\n");
     } else if (key == 'r') {
         star->getTexture().increaseResolution(100);
-        glutPostRedisplay();
+        scheduler.invalidate(DIRTY_TEXTURE);
     } else if (key == 'R') {
         star->getTexture().increaseResolution(-100);
-        glutPostRedisplay();}
+        scheduler.invalidate(DIRTY_TEXTURE);}
     else if (key == 't') {
-        star->getTexture().setFilteringMode(GL_NEAREST);
-        glutPostRedisplay();
+        selectFiltering(GL_NEAREST, false);
+        scheduler.invalidate(DIRTY_TEXTURE);
     } else if (key == 'T') {
-        star->getTexture().setFilteringMode(GL_LINEAR);
-        glutPostRedisplay();
+        selectFiltering(GL_LINEAR, false);
+        scheduler.invalidate(DIRTY_TEXTURE);
+    } else if (key == 'u') {
+        selectFiltering(GL_LINEAR_MIPMAP_LINEAR, false);
+        scheduler.invalidate(DIRTY_TEXTURE);
+    } else if (key == 'U') {
+        selectFiltering(GL_LINEAR_MIPMAP_LINEAR, true);
+        scheduler.invalidate(DIRTY_TEXTURE);
     }
-
+    scheduler.setContinuous(isAnimating || hud.isVisible() || frameCapture.isActive());
 }
 
 /**
@@ -534,7 +2423,6 @@ bool mouseLeftPressed = false, mouseRightPressed = false;
         float cX = 2.0f * (float)pX / windowWidth - 1;    // flip y axis
         float cY = 1.0f - 2.0f * (float)pY / windowHeight;
     }
-    glutPostRedisplay();
 }
 
 /**
@@ -562,13 +2450,35 @@ bool mouseLeftPressed = false, mouseRightPressed = false;
 /**
  * @brief Handles the idle event.
  *
- * This function is called when some time has elapsed. It is used to animate the star.
+ * This function is only registered while the star is animated or the performance overlay runs, see
+ * FrameScheduler. It waits for the deadline of the next frame, animates the star with the smoothed clock, and
+ * checks on the texture work like onPollTimer.
  */
  void onIdle() {
-    if (isAnimating) {
-        long currentTime = glutGet(GLUT_ELAPSED_TIME);
-        float elapsedTime = (float) (currentTime - time) / 1000;
-        star->Animate(elapsedTime);
-        glutPostRedisplay();
+    if (!scheduler.idle()) return;
+    TRACE_ZONE("onIdle"); // after the pacing sleep, which shows as the gap between the frames
+    double start = timestampMs();
+    pollBackgroundWork();
+    if (frameCapture.isActive()) {
+        scheduler.invalidate(DIRTY_STAR); // onDisplay animates the star to the time of the next captured frame
+    } else if (isAnimating) {
+        star->Animate(scheduler.tick());
+        scheduler.invalidate(DIRTY_STAR);
     }
+    if (hud.isVisible()) scheduler.invalidate(DIRTY_OVERLAY); // keep the statistics running
+    hud.idleTime.add(timestampMs() - start);
+}
+
+/**
+ * @brief Handles the poll timer of FrameScheduler::watch.
+ *
+ * This function checks on the texture work on other threads while the idle callback is not registered, and
+ * polls again until the work is done.
+ *
+ * @param value Unused.
+ */
+void onPollTimer(int /*value*/) {
+    TRACE_ZONE("onPollTimer");
+    scheduler.pollFired();
+    if (pollBackgroundWork()) scheduler.watch();
 }
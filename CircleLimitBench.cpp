@@ -0,0 +1,238 @@
+//=============================================================================================
+// CircleLimitBench: times the CPU texture generators without opening a window
+//
+// usage: CircleLimitBench [--min-size N] [--max-size N] [--repeat N] [--threads N] [--time-limit SECONDS]
+//                         [--paths serial,threaded,simd,span,span-aa4,quadtree,distance] [--tiling P,Q[,DEPTH]]
+//                         [--label TEXT] [--json FILE] [--trace FILE]
+//=============================================================================================
+#include "PoincareGenerator.h"
+#include <chrono>
+#include <string>
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/**
+ * @struct BenchPath
+ * @brief One way of running the CPU generation that is timed separately.
+ */
+struct BenchPath {
+    const char *name;           ///< The name of the path on the command line and in the report.
+    bool threaded;              ///< Run on all threads of the pool instead of on the calling thread only.
+    bool simd;                  ///< Use the widest supported parity kernel instead of the scalar loop.
+    TextureGenerator generator; ///< GENERATOR_CPU for the per-texel test, GENERATOR_SPAN for runs, GENERATOR_QUADTREE or GENERATOR_DISTANCE.
+    int samples;                ///< The subsamples per axis of the anti-aliased edge texels, 1 for none.
+};
+
+const BenchPath benchPaths[] = {
+        {"serial", false, false, GENERATOR_CPU, 1},
+        {"threaded", true, false, GENERATOR_CPU, 1},
+        {"simd", true, true, GENERATOR_CPU, 1},
+        {"span", true, false, GENERATOR_SPAN, 1},
+        {"span-aa4", true, true, GENERATOR_SPAN, 4},
+        {"quadtree", true, false, GENERATOR_QUADTREE, 1},
+        {"distance", true, false, GENERATOR_DISTANCE, 1},
+};
+
+/**
+ * @struct BenchResult
+ * @brief The measurements of one path at one size.
+ */
+struct BenchResult {
+    std::string path;          ///< The name of the path, or "math" for the circle computation.
+    int width = 0, height = 0; ///< The size of the texture.
+    double bestMs = 0;         ///< The shortest of the repeated runs in milliseconds.
+    double meanMs = 0;         ///< The mean of the repeated runs in milliseconds.
+    size_t oddTexels = 0;      ///< The number of CLASS_ODD texels, it changes if the output does.
+    size_t peakRss = 0;        ///< The peak resident set size of the process after the runs in bytes.
+};
+
+/**
+ * @brief Get the peak resident set size of the process so far.
+ * @return The peak resident set size in bytes, 0 if it is not available.
+ */
+size_t peakRssBytes() {
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+    return static_cast<size_t>(usage.ru_maxrss);        // bytes on macOS
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+#endif
+}
+
+/**
+ * @brief Get the time elapsed since a time point.
+ * @param start The time point.
+ * @return The elapsed time in milliseconds.
+ */
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Checks whether a path is in a comma separated list of path names.
+ * @param list The list, an empty one selects every path.
+ * @param name The name of the path.
+ * @return True if the path is selected.
+ */
+bool pathSelected(const std::string &list, const std::string &name) {
+    if (list.empty()) return true;
+    return ("," + list + ",").find("," + name + ",") != std::string::npos;
+}
+
+/**
+ * @brief Prints one result as a row of the table on the console.
+ * @param result The result.
+ */
+void printResult(const BenchResult &result) {
+    double pixels = static_cast<double>(result.width) * result.height;
+    if (pixels > 0) printf("%-9s %6d x %-6d", result.path.c_str(), result.width, result.height);
+    else printf("%-9s %15s", result.path.c_str(), "");
+    printf(" %10.2f ms %10.2f ms", result.bestMs, result.meanMs);
+    if (pixels > 0) printf(" %10.2f Mpx/s %9.2f ns/px", pixels / (result.bestMs * 1000), result.bestMs * 1e6 / pixels);
+    printf(" %8.1f MB\n", static_cast<double>(result.peakRss) / (1024 * 1024));
+}
+
+/**
+ * @brief Writes the results as JSON.
+ * @param fileName The name of the file.
+ * @param label A free text stored with the results, e.g. the commit.
+ * @param threads The number of threads of the threaded paths.
+ * @param tiling The tiling that was rendered.
+ * @param results The results.
+ * @return True if the file was written.
+ */
+bool writeJson(const std::string &fileName, const std::string &label, int threads, const TilingSpec &tiling,
+               const std::vector<BenchResult> &results) {
+    FILE *file = fopen(fileName.c_str(), "w");
+    if (!file) {
+        printf("Cannot open %s\n", fileName.c_str());
+        return false;
+    }
+    std::string escaped;
+    for (char c : label) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        if (static_cast<unsigned char>(c) >= ' ') escaped += c;
+    }
+    fprintf(file, "{\n  \"label\": \"%s\",\n  \"threads\": %d,\n  \"simd\": \"%s\",\n  \"tiling\": \"%s\",\n  \"results\": [\n",
+            escaped.c_str(), threads, simdLevelName(detectSimdLevel()), tiling.name().c_str());
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &result = results[i];
+        double pixels = static_cast<double>(result.width) * result.height;
+        fprintf(file, "    {\"path\": \"%s\", \"width\": %d, \"height\": %d, \"best_ms\": %.4f, \"mean_ms\": %.4f, "
+                      "\"mpixels_per_s\": %.4f, \"ns_per_pixel\": %.4f, \"odd_texels\": %llu, \"peak_rss_bytes\": %llu}%s\n",
+                result.path.c_str(), result.width, result.height, result.bestMs, result.meanMs,
+                pixels > 0 ? pixels / (result.bestMs * 1000) : 0.0, pixels > 0 ? result.bestMs * 1e6 / pixels : 0.0,
+                static_cast<unsigned long long>(result.oddTexels),
+                static_cast<unsigned long long>(result.peakRss), i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int minSize = 256, maxSize = 16384, repeat = 3;
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    double timeLimit = 30;
+    std::string paths, label, jsonFile, traceFile;
+    TilingSpec tiling;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--min-size" && hasValue) minSize = atoi(argv[++i]);
+        else if (arg == "--max-size" && hasValue) maxSize = atoi(argv[++i]);
+        else if (arg == "--repeat" && hasValue) repeat = std::max(1, atoi(argv[++i]));
+        else if (arg == "--threads" && hasValue) threads = atoi(argv[++i]);
+        else if (arg == "--time-limit" && hasValue) timeLimit = atof(argv[++i]);
+        else if (arg == "--paths" && hasValue) paths = argv[++i];
+        else if (arg == "--tiling" && hasValue && parseTilingSpec(argv[++i], tiling)) continue;
+        else if (arg == "--label" && hasValue) label = argv[++i];
+        else if (arg == "--json" && hasValue) jsonFile = argv[++i];
+        else if (arg == "--trace" && hasValue) traceFile = argv[++i];
+        else {
+            printf("usage: %s [--min-size N] [--max-size N] [--repeat N] [--threads N] [--time-limit SECONDS]\n"
+                   "          [--paths serial,threaded,simd,span,span-aa4,quadtree,distance] [--tiling P,Q[,DEPTH]]\n"
+                   "          [--label TEXT] [--json FILE] [--trace FILE]\n", argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (threads < 1) threads = 1;
+
+    TraceRecorder::instance().nameThread("main");
+    if (!traceFile.empty()) TraceRecorder::instance().start();
+    WorkerPool pool;
+    std::vector<BenchResult> results;
+    printf("%d threads, %s parity kernel, %s\n", threads, simdLevelName(detectSimdLevel()), tiling.name().c_str());
+
+    BenchResult math;
+    math.path = "math";
+    for (int run = 0; run < repeat; run++) {
+        auto start = std::chrono::steady_clock::now();
+        PoincareGenerator generator(pool, tiling);
+        double ms = millisecondsSince(start);
+        math.bestMs = run == 0 ? ms : std::min(math.bestMs, ms);
+        math.meanMs += ms / repeat;
+    }
+    math.peakRss = peakRssBytes();
+    printResult(math);
+    results.push_back(math);
+
+    PoincareGenerator generator(pool, tiling);
+    for (const BenchPath &path : benchPaths) {
+        if (!pathSelected(paths, path.name)) continue;
+        pool.setThreadCount(path.threaded ? threads : 1);
+        generator.setSimdLevel(path.simd ? detectSimdLevel() : SIMD_SCALAR);
+        for (int size = minSize; size <= maxSize; size *= 2) {
+            BenchResult result;
+            result.path = path.name;
+            result.width = result.height = size;
+            std::vector<unsigned char> classes;
+            std::vector<vec4> colors;
+            int runs = 0;
+            while (runs < repeat) { // a run over the time limit is not repeated
+                auto start = std::chrono::steady_clock::now();
+                if (path.generator == GENERATOR_DISTANCE)
+                    generator.renderDistanceField(size, size, classes, [] { return false; });
+                else generator.renderClasses(size, size, path.generator, classes, [] { return false; });
+                if (path.samples > 1) generator.antialias(size, size, path.samples, classes, colors, [] { return false; });
+                double ms = millisecondsSince(start);
+                result.bestMs = runs == 0 ? ms : std::min(result.bestMs, ms);
+                result.meanMs += ms;
+                runs++;
+                if (ms > timeLimit * 1000) break;
+            }
+            result.meanMs /= runs;
+            if (path.generator == GENERATOR_DISTANCE) { // odd parity inside the disk, i.e. both channels positive
+                for (size_t texel = 0; texel + 1 < classes.size(); texel += 2)
+                    if (classes[texel] >= 128 && classes[texel + 1] >= 128) result.oddTexels++;
+            } else result.oddTexels = static_cast<size_t>(std::count(classes.begin(), classes.end(), CLASS_ODD));
+            result.peakRss = peakRssBytes();
+            printResult(result);
+            results.push_back(result);
+            if (result.bestMs > timeLimit * 1000) {
+                printf("%-9s skipping the larger sizes, %d x %d took longer than %.0f s\n", path.name, size, size,
+                       timeLimit);
+                break;
+            }
+        }
+    }
+
+    if (!jsonFile.empty() && !writeJson(jsonFile, label, threads, tiling, results)) return 1;
+    if (!traceFile.empty()) {
+        long events = TraceRecorder::instance().write(traceFile);
+        if (events < 0) return 1;
+        printf("%ld trace events written to %s\n", events, traceFile.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+//=============================================================================================
+// CircleLimitExport: renders the tiling at any size straight into an image file, without a display
+//
+// usage: CircleLimitExport [--generator span|quadtree|cpu] [--threads N] [--band-rows N] [--tiling P,Q[,DEPTH]]
+//                          WIDTH HEIGHT FILE
+//
+// The format follows the extension of FILE: .ppm, .png or .tif/.tiff. --tiling renders a regular {p,q}
+// tessellation instead of the Circle Limit pattern.
+//=============================================================================================
+#include "ImageExport.h"
+#include <chrono>
+
+int main(int argc, char *argv[]) {
+    TextureGenerator cpuGenerator = GENERATOR_SPAN;
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    int bandRows = 0;
+    TilingSpec tiling;
+    std::vector<std::string> positional;
+    bool usage = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--generator" && hasValue) {
+            std::string name = argv[++i];
+            if (name == "cpu") cpuGenerator = GENERATOR_CPU;
+            else if (name == "span") cpuGenerator = GENERATOR_SPAN;
+            else if (name == "quadtree") cpuGenerator = GENERATOR_QUADTREE;
+            else usage = true;
+        }
+        else if (arg == "--threads" && hasValue) threads = atoi(argv[++i]);
+        else if (arg == "--band-rows" && hasValue) bandRows = atoi(argv[++i]);
+        else if (arg == "--tiling" && hasValue) usage = !parseTilingSpec(argv[++i], tiling) || usage;
+        else positional.push_back(arg);
+    }
+    if (positional.size() != 3) usage = true;
+    int width = usage ? 0 : atoi(positional[0].c_str());
+    int height = usage ? 0 : atoi(positional[1].c_str());
+    std::unique_ptr<ImageWriter> writer = usage ? nullptr : imageWriterFor(positional[2]);
+    if (width <= 0 || height <= 0 || !writer) {
+        printf("usage: %s [--generator span|quadtree|cpu] [--threads N] [--band-rows N] [--tiling P,Q[,DEPTH]]\n"
+               "          WIDTH HEIGHT FILE.{ppm,png,tif}\n", argv[0]);
+        return 1;
+    }
+    const std::string &fileName = positional[2];
+    if (bandRows <= 0) bandRows = static_cast<int>(std::max<size_t>(8, ((size_t)64 << 20) / (size_t)width));
+    bandRows = std::min(bandRows, height);
+
+    WorkerPool pool;
+    pool.setThreadCount(threads);
+    PoincareGenerator generator(pool, tiling);
+    if (!writer->open(fileName, width, height)) return 1;
+    printf("Exporting %d x %d of %s (%d circles) to %s with the %s generator, %d rows per band, %d threads\n", width,
+           height, tiling.name().c_str(), static_cast<int>(generator.getCircles().size()), fileName.c_str(),
+           textureGeneratorName(cpuGenerator), bandRows, pool.getThreadCount());
+
+    // while one band is written on its own thread the next one is rendered into the other buffer
+    std::vector<unsigned char> bands[2];
+    bands[0].resize((size_t)width * bandRows);
+    bands[1].resize((size_t)width * bandRows);
+    std::thread writing;
+    bool written = true;
+    auto start = std::chrono::steady_clock::now();
+    int reported = 0;
+    for (int firstRow = 0, band = 0; firstRow < height; firstRow += bandRows, band ^= 1) {
+        int lastRow = std::min(firstRow + bandRows, height);
+        generator.renderBand(width, firstRow, lastRow, cpuGenerator, bands[band].data(), [] { return false; });
+        if (writing.joinable()) writing.join();
+        if (!written) break;
+        writing = std::thread([&, band, firstRow, lastRow] {
+            written = writer->writeRows(bands[band].data(), lastRow - firstRow);
+        });
+        int percent = static_cast<int>(100LL * lastRow / height);
+        if (percent >= reported + 10 || lastRow == height) {
+            reported = percent;
+            printf("%3d%% rendered\n", percent);
+        }
+    }
+    if (writing.joinable()) writing.join();
+    if (!written || !writer->close()) {
+        printf("Writing %s failed\n", fileName.c_str());
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Wrote %s in %.2f s, %.2f Mpixels/s\n", fileName.c_str(), seconds,
+           static_cast<double>(width) * height / (seconds * 1e6));
+    return 0;
+}
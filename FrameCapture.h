@@ -0,0 +1,247 @@
+//=============================================================================================
+// FrameCapture: reads the frames of an animation back through pixel pack buffers and writes them on a thread
+//=============================================================================================
+#pragma once
+#include "framework.h"
+#include "PerformanceHud.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/**
+ * @class FrameCapture
+ * @brief Records frames of the window into numbered PPM files without stalling the GPU.
+ *
+ * @details Every captured frame is read with glReadPixels into the next GL_PIXEL_PACK_BUFFER of a ring, which
+ * only queues the copy, and fenced. The buffer is mapped ringSize frames later, when the copy is long done, so
+ * the frames arrive with ringSize frames of latency and neither side waits for the other. The pixels are handed
+ * to a writer thread that flips the rows and writes the file; when it falls maxQueued frames behind, capture
+ * waits for it instead of dropping frames. The animation runs on a fixed timestep, see frameTime.
+ */
+class FrameCapture {
+    /**
+     * @struct Frame
+     * @brief A frame read back from the GPU and waiting for the writer thread.
+     */
+    struct Frame {
+        unsigned long index;               ///< The number of the frame.
+        std::vector<unsigned char> pixels; ///< The RGBA pixels, bottom row first.
+    };
+
+    static const int ringSize = 3;          ///< The pixel pack buffers, and the frames of latency.
+    static const size_t maxQueued = 8;      ///< The frames the writer thread may fall behind before capture waits.
+    int width = 0, height = 0;              ///< The size of the frames.
+    unsigned int buffers[ringSize] = {};    ///< The pixel pack buffers of the ring.
+    GLsync fences[ringSize] = {};           ///< The fences after the glReadPixels into each buffer.
+    bool active = false;                    ///< Frames are being captured.
+    std::string directory;                  ///< The directory the files are written to.
+    double framesPerSecond = 60;            ///< The rate of the fixed timestep.
+    float startTime = 0;                    ///< The animation time of the first frame.
+    unsigned long framesIssued = 0;         ///< The frames read into the ring so far.
+    double startMs = 0;                     ///< The time stamp capturing started at.
+    std::thread writer;                     ///< Writes the frames of the queue.
+    std::mutex queueMutex;                  ///< Guards the queue, the spare buffers and the counters of the writer.
+    std::condition_variable queueChanged;   ///< Signals a queued frame, a written one or stopping.
+    std::deque<Frame> queue;                ///< The frames read back and not written yet.
+    std::vector<std::vector<unsigned char>> spare; ///< Pixel buffers of written frames, reused for the next ones.
+    bool stopping = false;                  ///< Tells the writer thread to exit once the queue is empty.
+    unsigned long framesWritten = 0;        ///< The frames written so far.
+    bool writeFailed = false;               ///< A file could not be written.
+
+    /**
+     * @brief Maps a buffer of the ring and queues its frame for the writer thread.
+     * @param slot The buffer.
+     * @param index The number of the frame in the buffer.
+     */
+    void collect(int slot, unsigned long index) {
+        TRACE_ZONE("FrameCapture::collect");
+        while (glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+        glDeleteSync(fences[slot]);
+        fences[slot] = nullptr;
+        size_t bytes = (size_t)width * height * 4;
+        Frame frame;
+        frame.index = index;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueChanged.wait(lock, [&] { return queue.size() < maxQueued; });
+            if (!spare.empty()) {
+                frame.pixels.swap(spare.back());
+                spare.pop_back();
+            }
+        }
+        frame.pixels.resize(bytes);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[slot]);
+        const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+        if (mapped) memcpy(frame.pixels.data(), mapped, bytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queue.push_back(std::move(frame));
+        queueChanged.notify_all();
+    }
+
+    /**
+     * @brief Writes a frame as a binary PPM file, top row first and without the alpha channel.
+     * @param frame The frame.
+     * @param row A buffer for one row of RGB pixels.
+     * @return True if the file was written.
+     */
+    bool writeFrame(const Frame &frame, std::vector<unsigned char> &row) const {
+        TRACE_ZONE("FrameCapture::writeFrame");
+        char name[64];
+        snprintf(name, sizeof(name), "/frame%05lu.ppm", frame.index);
+        FILE *file = fopen((directory + name).c_str(), "wb");
+        if (!file) return false;
+        bool written = fprintf(file, "P6\n%d %d\n255\n", width, height) > 0;
+        row.resize((size_t)width * 3);
+        for (int y = height - 1; y >= 0 && written; y--) {
+            const unsigned char *in = frame.pixels.data() + (size_t)y * width * 4;
+            for (int x = 0; x < width; x++) {
+                row[3 * x] = in[4 * x];
+                row[3 * x + 1] = in[4 * x + 1];
+                row[3 * x + 2] = in[4 * x + 2];
+            }
+            written = fwrite(row.data(), 1, row.size(), file) == row.size();
+        }
+        return fclose(file) == 0 && written;
+    }
+
+    /**
+     * @brief The main loop of the writer thread.
+     */
+    void writerLoop() {
+        TraceRecorder::instance().nameThread("frame writer");
+        std::vector<unsigned char> row;
+        while (true) {
+            Frame frame;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueChanged.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                frame = std::move(queue.front());
+                queue.pop_front();
+            }
+            bool written = writeFrame(frame, row);
+            std::lock_guard<std::mutex> lock(queueMutex);
+            if (!written && !writeFailed) printf("Cannot write frame %lu to %s\n", frame.index, directory.c_str());
+            writeFailed = writeFailed || !written;
+            framesWritten++;
+            spare.push_back(std::move(frame.pixels));
+            queueChanged.notify_all();
+        }
+    }
+
+public:
+    FrameCapture() = default;
+    FrameCapture(const FrameCapture &) = delete;
+    FrameCapture &operator=(const FrameCapture &) = delete;
+
+    /**
+     * @brief Starts capturing frames.
+     * @param frameWidth The width of the frames.
+     * @param frameHeight The height of the frames.
+     * @param outputDirectory The directory of the files, created if it does not exist.
+     * @param rate The frames per second of the fixed timestep.
+     * @param time The animation time of the first frame.
+     */
+    void start(int frameWidth, int frameHeight, const std::string &outputDirectory, double rate, float time) {
+        if (active) return;
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+        CreateDirectoryA(outputDirectory.c_str(), nullptr);
+#else
+        mkdir(outputDirectory.c_str(), 0755);
+#endif
+        width = frameWidth;
+        height = frameHeight;
+        directory = outputDirectory;
+        framesPerSecond = rate;
+        startTime = time;
+        framesIssued = 0;
+        framesWritten = 0;
+        writeFailed = false;
+        stopping = false;
+        glGenBuffers(ringSize, buffers);
+        for (int slot = 0; slot < ringSize; slot++) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[slot]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * 4, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        writer = std::thread(&FrameCapture::writerLoop, this);
+        startMs = timestampMs();
+        active = true;
+    }
+
+    /**
+     * @brief Check whether frames are being captured.
+     * @return True while capturing.
+     */
+    bool isActive() const { return active; }
+
+    /**
+     * @brief Get the animation time of the next captured frame.
+     * @return The start time advanced by one fixed timestep per captured frame, in seconds.
+     */
+    float frameTime() const { return startTime + static_cast<float>(framesIssued / framesPerSecond); }
+
+    /**
+     * @brief Captures the frame drawn into the back buffer, call it before glutSwapBuffers.
+     *
+     * @details The buffer read ringSize frames ago is queued for the writer first, then the new frame is read
+     * into it; the read only queues a copy on the GPU.
+     */
+    void capture() {
+        int slot = static_cast<int>(framesIssued % ringSize);
+        if (framesIssued >= static_cast<unsigned long>(ringSize)) collect(slot, framesIssued - ringSize);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[slot]);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        framesIssued++;
+    }
+
+    /**
+     * @brief Stops capturing, collects the frames still in the ring and waits until all of them are written.
+     */
+    void stop() {
+        if (!active) return;
+        unsigned long first = framesIssued > static_cast<unsigned long>(ringSize) ? framesIssued - ringSize : 0;
+        for (unsigned long index = first; index < framesIssued; index++) collect(static_cast<int>(index % ringSize), index);
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueChanged.notify_all();
+        writer.join();
+        glDeleteBuffers(ringSize, buffers);
+        spare.clear();
+        active = false;
+        double seconds = (timestampMs() - startMs) / 1000;
+        printf("Captured %lu frames of %dx%d to %s in %.1f s (%.1f frames/s)\n", framesWritten, width, height,
+               directory.c_str(), seconds, seconds > 0 ? framesWritten / seconds : 0.0);
+    }
+
+    /**
+     * @brief Formats the progress of the capture for the overlay.
+     * @return The frames read back and written.
+     */
+    std::string describe() {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        char line[128];
+        snprintf(line, sizeof(line), "capturing %dx%d at %.0f fps: %lu frames read, %lu written, %d queued", width,
+                 height, framesPerSecond, framesIssued, framesWritten, static_cast<int>(queue.size()));
+        return line;
+    }
+
+    /**
+     * @brief Destructor, lets the writer thread finish the queued frames, the GL context may be gone by now.
+     */
+    ~FrameCapture() {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueChanged.notify_all();
+        if (writer.joinable()) writer.join();
+    }
+};
@@ -0,0 +1,256 @@
+//=============================================================================================
+// FrameScheduler: dirty-tracking redraws, frame pacing and a smoothed animation clock
+//=============================================================================================
+#pragma once
+#include "framework.h"
+#include "PerformanceHud.h"
+#include <thread>
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+#include <GL/wglew.h>   // wglSwapIntervalEXT
+#elif !defined(__APPLE__)
+#include <GL/glxew.h>   // glXSwapIntervalMESA, glXSwapIntervalSGI
+#endif
+
+/**
+ * @enum DirtyFlag
+ * @brief The parts of the scene whose change needs a redraw.
+ */
+enum DirtyFlag {
+    DIRTY_STAR = 1,    ///< The shape, the animation or the mode of the star.
+    DIRTY_TEXTURE = 2, ///< The content or the sampling of the texture.
+    DIRTY_CAMERA = 4,  ///< The camera window.
+    DIRTY_OVERLAY = 8, ///< The performance overlay.
+    DIRTY_ALL = 15     ///< Every part, the state before the first frame.
+};
+
+/**
+ * @enum PacingMode
+ * @brief How the frames of a running animation are spaced.
+ */
+enum PacingMode {
+    PACING_60_FPS,   ///< Sleep until the deadline of the next frame at 60 frames per second.
+    PACING_30_FPS,   ///< Sleep until the deadline of the next frame at 30 frames per second.
+    PACING_VSYNC,    ///< Swap with a swap interval of 1, so glutSwapBuffers waits for the display.
+    PACING_UNLIMITED,///< Draw as fast as possible, e.g. to measure the frame time.
+    PACING_COUNT     ///< The number of pacing modes.
+};
+
+/**
+ * @brief Get the printable name of a pacing mode.
+ * @param mode The pacing mode.
+ * @return The name.
+ */
+inline const char *pacingModeName(PacingMode mode) {
+    switch (mode) {
+        case PACING_60_FPS: return "60 fps";
+        case PACING_30_FPS: return "30 fps";
+        case PACING_VSYNC: return "vsync";
+        case PACING_UNLIMITED: return "unlimited";
+        default: return "unknown";
+    }
+}
+
+/**
+ * @class FrameScheduler
+ * @brief Decides when a frame is drawn, so that the GLUT loop only runs while something changes.
+ *
+ * @details A change marks a part of the scene dirty, and only the first change after a frame posts a redisplay.
+ * The idle callback is registered only while the scene changes by itself, i.e. while the star is animated or the
+ * overlay runs; then it sleeps until the deadline of the next frame, or leaves the pacing to the swap interval.
+ * Work running on other threads is polled with a GLUT timer instead of the idle loop. The animation time advances
+ * by an exponential moving average of the frame times, so the jitter of the sleeps does not show as uneven motion
+ * and a stall does not make the star jump.
+ */
+class FrameScheduler {
+    void (*idleCallback)();     ///< The GLUT idle callback, registered while the scene is continuous.
+    void (*pollCallback)(int);  ///< The GLUT timer callback polling the work of other threads.
+    unsigned int dirty = DIRTY_ALL; ///< The DirtyFlag bits changed since the last frame, GLUT draws the first one.
+    bool continuous = true;     ///< The scene changes by itself, GLUT registers idleCallback at the start.
+    bool pollArmed = false;     ///< The poll timer is pending.
+    PacingMode pacing = PACING_60_FPS; ///< The pacing of continuous frames.
+    int swapInterval = -1;      ///< The swap interval last set, -1 if none was set.
+    double nextDeadline = 0;    ///< The time stamp the next paced frame is due at in milliseconds.
+    double lastTick = 0;        ///< The time stamp of the last animation step in milliseconds.
+    double smoothedDt = 0;      ///< The smoothed frame time in seconds.
+    int ticks = 0;              ///< The animation steps since the clock was reset.
+    double animationTime = 0;   ///< The smoothed animation clock in seconds.
+    unsigned long framesDrawn = 0;       ///< The frames drawn so far.
+    unsigned long changesCoalesced = 0;  ///< The changes that did not cause a redraw of their own.
+
+    /**
+     * @brief Sets the swap interval of the window, where the platform supports it.
+     * @param interval 1 to wait for the vertical blank in glutSwapBuffers, 0 not to.
+     * @return True if the interval was set.
+     */
+    bool setSwapInterval(int interval) {
+        if (swapInterval == interval) return true;
+        bool set = false;
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+        if (WGLEW_EXT_swap_control) set = wglSwapIntervalEXT(interval) != FALSE;
+#elif !defined(__APPLE__)
+        if (GLXEW_MESA_swap_control) set = glXSwapIntervalMESA(static_cast<unsigned int>(interval)) == 0;
+        else if (GLXEW_SGI_swap_control && interval > 0) set = glXSwapIntervalSGI(interval) == 0; // no 0 in SGI
+#endif
+        if (set) swapInterval = interval;
+        return set;
+    }
+
+public:
+    static constexpr double pollIntervalMs = 15;  ///< The period of polling the work of other threads.
+    static constexpr double maxDtSeconds = 0.1;   ///< Longer frame times, e.g. stalls, advance the animation by this.
+    static constexpr double smoothing = 0.1;      ///< The weight of a new frame time in the moving average.
+
+    /**
+     * @brief Constructor.
+     * @param idle The GLUT idle callback of the application.
+     * @param poll The GLUT timer callback that polls the work of other threads and calls watch while it goes on.
+     */
+    FrameScheduler(void (*idle)(), void (*poll)(int)) : idleCallback(idle), pollCallback(poll) {}
+
+    /**
+     * @brief Marks parts of the scene as changed, posting a redisplay for the first change after a frame.
+     * @param flags The DirtyFlag bits of the parts.
+     */
+    void invalidate(unsigned int flags) {
+        if (dirty == 0) glutPostRedisplay();
+        else changesCoalesced++;
+        dirty |= flags;
+    }
+
+    /**
+     * @brief Records that a frame is being drawn, which cleans every part of the scene.
+     *
+     * @details GLUT also draws frames nothing asked for, e.g. when the window is exposed, so the frame must still
+     * draw everything; the flags only tell which state has to be brought up to date first.
+     *
+     * @return The DirtyFlag bits changed since the last frame, 0 for a frame that only repaints the window.
+     */
+    unsigned int frameStarted() {
+        unsigned int drawn = dirty;
+        dirty = 0;
+        framesDrawn++;
+        return drawn;
+    }
+
+    /**
+     * @brief Turns the continuous frames of an animation on or off.
+     *
+     * @details Turning them off takes effect at the next idle call, see idle.
+     *
+     * @param on True while the scene changes by itself.
+     */
+    void setContinuous(bool on) {
+        if (on && !continuous) {
+            nextDeadline = 0;
+            glutIdleFunc(idleCallback);
+        }
+        continuous = on;
+    }
+
+    /**
+     * @brief Waits until the next continuous frame is due, call it at the start of the idle callback.
+     *
+     * @details Once the scene is no longer continuous the idle callback is unregistered, so GLUT blocks until the
+     * next event. In the fps modes the thread sleeps until 1.5 ms before the deadline and yields for the rest, the
+     * deadline advances by one period per frame and is reset after a frame that came too late.
+     *
+     * @return False if the idle callback was unregistered and there is no frame to prepare.
+     */
+    bool idle() {
+        if (!continuous) {
+            glutIdleFunc(nullptr);
+            return false;
+        }
+        if (pacing == PACING_VSYNC || pacing == PACING_UNLIMITED) return true;
+        double period = pacing == PACING_30_FPS ? 1000.0 / 30 : 1000.0 / 60;
+        double now = timestampMs();
+        if (nextDeadline == 0 || now > nextDeadline + period) nextDeadline = now;
+        if (nextDeadline - now > 1.5)
+            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(nextDeadline - now - 1.5));
+        while (timestampMs() < nextDeadline) std::this_thread::yield();
+        nextDeadline += period;
+        return true;
+    }
+
+    /**
+     * @brief Polls the work of other threads with a GLUT timer, unless the idle loop runs anyway.
+     */
+    void watch() {
+        if (pollArmed || continuous) return;
+        pollArmed = true;
+        glutTimerFunc(static_cast<unsigned int>(pollIntervalMs), pollCallback, 0);
+    }
+
+    /**
+     * @brief Records that the poll timer has fired, call it first in the timer callback.
+     */
+    void pollFired() { pollArmed = false; }
+
+    /**
+     * @brief Selects the pacing mode and the swap interval that goes with it.
+     *
+     * @details The other modes turn the swap interval off where that is possible, so it does not add to their pacing.
+     *
+     * @param mode The pacing mode.
+     * @return False if vsync was selected but the swap interval cannot be set, then 60 fps is used.
+     */
+    bool setPacing(PacingMode mode) {
+        pacing = mode;
+        nextDeadline = 0;
+        bool swapSet = setSwapInterval(mode == PACING_VSYNC ? 1 : 0);
+        if (mode != PACING_VSYNC || swapSet) return true;
+        pacing = PACING_60_FPS;
+        return false;
+    }
+
+    /**
+     * @brief Get the pacing mode.
+     * @return The pacing mode.
+     */
+    PacingMode getPacing() const { return pacing; }
+
+    /**
+     * @brief Restarts the animation clock.
+     * @param seconds The animation time to continue from.
+     */
+    void resetAnimationClock(double seconds = 0) {
+        lastTick = timestampMs();
+        smoothedDt = 0;
+        ticks = 0;
+        animationTime = seconds;
+    }
+
+    /**
+     * @brief Advances the animation clock by the smoothed frame time, once per animated frame.
+     *
+     * @details The first step after a reset may come at once, so the average starts with the frame time of the
+     * second step.
+     *
+     * @return The animation time in seconds.
+     */
+    float tick() {
+        double now = timestampMs();
+        double dt = (now - lastTick) / 1000;
+        if (dt > maxDtSeconds) dt = maxDtSeconds;
+        lastTick = now;
+        if (ticks++ == 0) {
+            animationTime += dt;
+            return static_cast<float>(animationTime);
+        }
+        smoothedDt = ticks == 2 ? dt : smoothedDt + smoothing * (dt - smoothedDt);
+        animationTime += smoothedDt;
+        return static_cast<float>(animationTime);
+    }
+
+    /**
+     * @brief Formats the state of the scheduler for the overlay.
+     * @return The pacing, the idle loop and the frame counts.
+     */
+    std::string describe() const {
+        char line[128];
+        snprintf(line, sizeof(line), "pacing %s, idle loop %s, %lu frames, %lu changes coalesced", pacingModeName(pacing),
+                 continuous ? "on" : "off", framesDrawn, changesCoalesced);
+        return line;
+    }
+};
@@ -0,0 +1,447 @@
+//=============================================================================================
+// HyperbolicTiling: the circles of the tilings of the Poincare disk
+//
+// The default Circle Limit pattern is a table computed by the compiler. The regular {p,q}
+// tessellations are generated at run time, tile by tile, up to a configurable depth.
+//=============================================================================================
+#pragma once
+#include "framework.h"
+#include <algorithm>
+#include <complex>
+#include <map>
+#include <deque>
+
+//---------------------------
+// C++11 constexpr functions may only consist of a single return statement, so these recurse instead of looping.
+
+/**
+ * @brief The terms of the Taylor series of exp from the n-th one on.
+ * @param x The argument.
+ * @param term The n-th term, x^n / n!.
+ * @param n The index of the term.
+ * @return The sum of the remaining terms.
+ */
+constexpr double constexprExpSeries(double x, double term, int n) {
+    return n > 60 ? 0 : term + constexprExpSeries(x, term * x / (n + 1), n + 1);
+}
+
+/**
+ * @brief exp for constant expressions, accurate for |x| < 10.
+ * @param x The argument.
+ * @return e^x.
+ */
+constexpr double constexprExp(double x) { return constexprExpSeries(x, 1, 0); }
+
+/**
+ * @brief cosh for constant expressions.
+ * @param x The argument.
+ * @return cosh(x).
+ */
+constexpr double constexprCosh(double x) { return (constexprExp(x) + 1 / constexprExp(x)) / 2; }
+
+/**
+ * @brief sinh for constant expressions.
+ * @param x The argument.
+ * @return sinh(x).
+ */
+constexpr double constexprSinh(double x) { return (constexprExp(x) - 1 / constexprExp(x)) / 2; }
+
+/**
+ * @brief The terms of the Taylor series of sin (odd n) or cos (even n) from the n-th one on.
+ * @param x The argument.
+ * @param term The n-th term, +-x^n / n!.
+ * @param n The index of the term.
+ * @return The sum of the remaining terms.
+ */
+constexpr double constexprTrigSeries(double x, double term, int n) {
+    return n > 60 ? 0 : term + constexprTrigSeries(x, -term * x * x / ((n + 1) * (n + 2)), n + 2);
+}
+
+/**
+ * @brief cos for constant expressions, accurate for |x| < 2 pi.
+ * @param x The argument.
+ * @return cos(x).
+ */
+constexpr double constexprCos(double x) { return constexprTrigSeries(x, 1, 0); }
+
+/**
+ * @brief sin for constant expressions, accurate for |x| < 2 pi.
+ * @param x The argument.
+ * @return sin(x).
+ */
+constexpr double constexprSin(double x) { return constexprTrigSeries(x, x, 1); }
+
+/**
+ * @brief The Newton iteration of sqrt.
+ * @param x The argument.
+ * @param guess The current estimate.
+ * @param steps The number of steps left.
+ * @return The estimate after the remaining steps.
+ */
+constexpr double constexprSqrtNewton(double x, double guess, int steps) {
+    return steps == 0 ? guess : constexprSqrtNewton(x, (guess + x / guess) / 2, steps - 1);
+}
+
+/**
+ * @brief sqrt for constant expressions, for arguments between 1e-6 and 1e6.
+ * @param x The argument.
+ * @return The square root of x.
+ */
+constexpr double constexprSqrt(double x) { return x <= 0 ? 0 : constexprSqrtNewton(x, x > 1 ? x : 1, 40); }
+
+//---------------------------
+/**
+ * @struct CircleEntry
+ * @brief A circle of a compile-time table.
+ */
+struct CircleEntry {
+    float x; ///< The x-coordinate of the centre.
+    float y; ///< The y-coordinate of the centre.
+    float r; ///< The radius.
+};
+
+const int defaultDirections = 9; ///< The directions of the default tiling, 40 degrees apart.
+const int defaultDistances = 6;  ///< The hyperbolic distances per direction of the default tiling, 0.5 to 5.5.
+
+/**
+ * @brief The circle through a point of the Poincare disk, orthogonal to the unit circle and to the ray to the point.
+ * @param px The x-coordinate of the point.
+ * @param py The y-coordinate of the point.
+ * @param length The distance of the point from the centre of the disk.
+ * @return The circle.
+ */
+constexpr CircleEntry perpendicularGeodesic(double px, double py, double length) {
+    return CircleEntry{static_cast<float>(px + px / length * ((1 / length - length) / 2)),
+                       static_cast<float>(py + py / length * ((1 / length - length) / 2)),
+                       static_cast<float>((1 / length - length) / 2)};
+}
+
+/**
+ * @brief The point of the Poincare disk a point of the hyperboloid projects to, passed on to perpendicularGeodesic.
+ * @param x The x-coordinate on the hyperboloid.
+ * @param y The y-coordinate on the hyperboloid.
+ * @param z The z-coordinate on the hyperboloid.
+ * @return The circle through the projected point.
+ */
+constexpr CircleEntry projectedGeodesic(double x, double y, double z) {
+    return perpendicularGeodesic(x / (z + 1), y / (z + 1), constexprSqrt((x * x + y * y) / ((z + 1) * (z + 1))));
+}
+
+/**
+ * @brief The point at distance dh in a direction of the default tiling, as the original calcH computed it.
+ * @param cosAngle The cosine of the direction.
+ * @param sinAngle The sine of the direction.
+ * @param dh The hyperbolic distance.
+ * @return The circle through the point.
+ */
+constexpr CircleEntry defaultGeodesicAt(double cosAngle, double sinAngle, double dh) {
+    // (0,0,1) cosh dh + ((0,0,1) sinh dh + (cos, sin, 0) cosh dh) sinh dh
+    return projectedGeodesic(cosAngle * constexprCosh(dh) * constexprSinh(dh), sinAngle * constexprCosh(dh) * constexprSinh(dh),
+                             constexprCosh(dh) + constexprSinh(dh) * constexprSinh(dh));
+}
+
+/**
+ * @brief The i-th circle of the default tiling, direction by direction.
+ * @param i The index of the circle.
+ * @return The circle.
+ */
+constexpr CircleEntry defaultCircle(int i) {
+    return defaultGeodesicAt(constexprCos(i / defaultDistances * 40 * 3.14159265358979323846 / 180),
+                             constexprSin(i / defaultDistances * 40 * 3.14159265358979323846 / 180),
+                             0.5 + i % defaultDistances);
+}
+
+/**
+ * @struct IndexList
+ * @brief A pack of the indices 0..N-1, the C++11 stand-in for std::index_sequence.
+ */
+template<int... I> struct IndexList {};
+
+/**
+ * @struct MakeIndexList
+ * @brief Builds IndexList<0, ..., N-1> as its type member.
+ */
+template<int N, int... I> struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> {};
+
+template<int... I> struct MakeIndexList<0, I...> { typedef IndexList<I...> type; };
+
+/**
+ * @struct CircleTableOf
+ * @brief A circle table evaluated by the compiler, one defaultCircle per index.
+ */
+template<typename Indices> struct CircleTableOf;
+
+template<int... I> struct CircleTableOf<IndexList<I...>> {
+    static constexpr int count = sizeof...(I);            ///< The number of circles.
+    static constexpr CircleEntry circles[count] = {defaultCircle(I)...}; ///< The circles.
+};
+
+template<int... I> constexpr CircleEntry CircleTableOf<IndexList<I...>>::circles[];
+
+/**
+ * @brief The circles of the default tiling, computed at compile time.
+ */
+typedef CircleTableOf<MakeIndexList<defaultDirections * defaultDistances>::type> DefaultCircleTable;
+
+//---------------------------
+/**
+ * @struct TilingSpec
+ * @brief Selects the tiling whose circles are generated.
+ */
+struct TilingSpec {
+    int p = 0;     ///< The number of sides of a tile, 0 for the default Circle Limit pattern.
+    int q = 0;     ///< The number of tiles meeting at a vertex.
+    int depth = 0; ///< The number of rings of tiles around the central one.
+
+    /**
+     * @brief Constructor.
+     * @param p The number of sides of a tile, 0 for the default pattern.
+     * @param q The number of tiles meeting at a vertex.
+     * @param depth The number of rings of tiles around the central one.
+     */
+    explicit TilingSpec(int p = 0, int q = 0, int depth = 0) : p(p), q(q), depth(depth) {}
+
+    /**
+     * @brief Checks whether this is the default pattern.
+     * @return True for the compile-time table.
+     */
+    bool isDefault() const { return p == 0; }
+
+    /**
+     * @brief Checks whether {p,q} is a tessellation of the hyperbolic plane.
+     * @return True if (p - 2)(q - 2) > 4, always true for the default pattern.
+     */
+    bool isHyperbolic() const { return isDefault() || (p >= 3 && q >= 3 && (p - 2) * (q - 2) > 4); }
+
+    /**
+     * @brief Compare two specifications.
+     * @param spec The other specification.
+     * @return True if both select the same circles.
+     */
+    bool operator==(const TilingSpec &spec) const {
+        return p == spec.p && (isDefault() || (q == spec.q && depth == spec.depth));
+    }
+
+    /**
+     * @brief Get a printable name.
+     * @return "Circle Limit" or e.g. "{5,4} depth 4".
+     */
+    std::string name() const {
+        if (isDefault()) return "Circle Limit";
+        char text[64];
+        snprintf(text, sizeof(text), "{%d,%d} depth %d", p, q, depth);
+        return text;
+    }
+};
+
+/**
+ * @class PQTilingBuilder
+ * @brief Generates the geodesics carrying the edges of a regular {p,q} tessellation of the Poincare disk.
+ *
+ * @details The central tile is centred on the origin, and the tiles of every further ring are the reflections of
+ * the previous ring in their edges. The geodesic of every edge becomes a circle orthogonal to the unit circle, so
+ * the parity of the circles covering a point tells the tiles apart: for even q every geodesic is a union of edges
+ * and the parity is the checkerboard colouring of the tiles. For odd q no two colours can tell the tiles around a
+ * vertex apart, and the geodesics of the edges cross other tiles, so the symmetry axes of every tile, through its
+ * centre and each vertex and edge midpoint, are generated as well. Edges and axes together are the mirrors of the
+ * (2,p,q) triangle group, and the parity colours the 2p triangles of every tile by the parity of their reflection
+ * word. The axes of the central tile would run through the origin, where the circle form breaks down, so the
+ * tiling is moved slightly off the centre, halfway between two of them. Tiles and circles smaller than minRadius,
+ * below a texel of the largest textures, are dropped. The computation uses double precision; only the circles are
+ * kept.
+ */
+class PQTilingBuilder {
+    typedef std::complex<double> point; ///< A point of the disk.
+
+    /**
+     * @struct Geodesic
+     * @brief A geodesic as a circle orthogonal to the unit circle.
+     */
+    struct Geodesic {
+        point centre;  ///< The centre of the circle.
+        double radius; ///< The radius of the circle, 0 if the geodesic runs through the origin.
+    };
+
+    static constexpr double minRadius = 1e-5;   ///< Smaller circles and tiles are not generated.
+    static constexpr double quantum = 1e-7;     ///< The grid of the duplicate detection.
+    typedef std::pair<long long, long long> Cell; ///< A cell of the duplicate detection grid.
+
+    /**
+     * @brief Get the grid cell of a point for the duplicate detection.
+     * @param z The point.
+     * @return The cell.
+     */
+    static Cell cellOf(point z) {
+        return Cell(static_cast<long long>(floor(z.real() / quantum)), static_cast<long long>(floor(z.imag() / quantum)));
+    }
+
+    /**
+     * @brief Looks for a point close to z in a grid and adds z if there is none.
+     * @param grid The points found so far by cell.
+     * @param z The point.
+     * @param tolerance The distance below which two points are the same.
+     * @return True if z is new.
+     */
+    static bool insertUnique(std::map<Cell, point> &grid, point z, double tolerance) {
+        Cell cell = cellOf(z);
+        for (long long dx = -1; dx <= 1; dx++)
+            for (long long dy = -1; dy <= 1; dy++) {
+                auto it = grid.find(Cell(cell.first + dx, cell.second + dy));
+                if (it != grid.end() && std::abs(it->second - z) < tolerance) return false;
+            }
+        grid[cell] = z;
+        return true;
+    }
+
+    /**
+     * @brief Get the geodesic through two points.
+     * @param a The first point.
+     * @param b The second point.
+     * @return The geodesic, with radius 0 if it runs through the origin.
+     */
+    static Geodesic geodesicThrough(point a, point b) {
+        // the centre c satisfies 2 c.a = |a|^2 + 1 and 2 c.b = |b|^2 + 1, then r^2 = |c|^2 - 1
+        double det = 2 * (a.real() * b.imag() - a.imag() * b.real());
+        Geodesic geodesic{point(0, 0), 0};
+        if (std::abs(det) < 1e-12) return geodesic;
+        double ea = std::norm(a) + 1, eb = std::norm(b) + 1;
+        geodesic.centre = point((ea * b.imag() - eb * a.imag()) / det, (eb * a.real() - ea * b.real()) / det);
+        geodesic.radius = sqrt(std::max(0.0, std::norm(geodesic.centre) - 1));
+        return geodesic;
+    }
+
+    /**
+     * @brief Reflects a point in a geodesic, an inversion in its circle.
+     * @param z The point.
+     * @param g The geodesic.
+     * @return The reflected point.
+     */
+    static point reflect(point z, const Geodesic &g) {
+        return g.centre + g.radius * g.radius / std::conj(z - g.centre);
+    }
+
+    /**
+     * @brief Adds the circle of a geodesic unless it is too small or already there.
+     *
+     * A geodesic is identified by the inverse of its centre, the midpoint of the chord between its ends, which is
+     * far better conditioned than the centre of a large circle.
+     *
+     * @param circles The circles found so far.
+     * @param lineMidpoints The chord midpoints of the circles found so far by cell.
+     * @param g The geodesic.
+     */
+    static void addGeodesic(std::vector<vec3> &circles, std::map<Cell, point> &lineMidpoints, const Geodesic &g) {
+        if (g.radius < minRadius) return;
+        if (insertUnique(lineMidpoints, g.centre / std::norm(g.centre), quantum))
+            circles.emplace_back(static_cast<float>(g.centre.real()), static_cast<float>(g.centre.imag()),
+                                 static_cast<float>(g.radius));
+    }
+
+    /**
+     * @brief Checks whether the point of a geodesic closest to the origin lies within the circumcircle of a tile.
+     *
+     * Far from the origin the points of a tile are accurate only in absolute terms, and a geodesic through them
+     * drifts off as it comes back towards the centre, so for odd q every geodesic is taken from the tiles around
+     * the point where it comes closest to the origin, and no copy of it from farther tiles can slip past
+     * addGeodesic.
+     *
+     * @param tile The vertices of the tile, then its centre.
+     * @param p The number of vertices.
+     * @param g The geodesic, with a radius greater than 0.
+     * @return True if the tile should add the geodesic.
+     */
+    static bool closestPointInTile(const std::vector<point> &tile, int p, const Geodesic &g) {
+        point closest = g.centre * (1 - g.radius / std::abs(g.centre));
+        // the pseudo-hyperbolic distance |a - b| / |1 - conj(b) a| grows with the hyperbolic distance
+        auto distance = [](point a, point b) { return std::abs(a - b) / std::abs(1.0 - std::conj(b) * a); };
+        return distance(closest, tile[p]) <= distance(tile[0], tile[p]) * (1 + 1e-6);
+    }
+
+public:
+    /**
+     * @brief Generates the circles of a tiling.
+     * @param spec The tiling, p > 0.
+     * @return The circles as (centre x, centre y, radius), empty if {p,q} is not hyperbolic.
+     */
+    static std::vector<vec3> build(const TilingSpec &spec) {
+        TRACE_ZONE("PQTilingBuilder::build");
+        std::vector<vec3> circles;
+        if (spec.isDefault()) return circles;
+        if (!spec.isHyperbolic()) {
+            printf("{%d,%d} is not a hyperbolic tiling, (p - 2)(q - 2) must be greater than 4\n", spec.p, spec.q);
+            return circles;
+        }
+        const int p = spec.p;
+        const bool axes = spec.q % 2 != 0; // see the class description
+        // the circumradius R of a tile: cosh R = cot(pi / p) cot(pi / q), in the disk at tanh(R / 2)
+        double coshR = 1 / (tan(M_PI / p) * tan(M_PI / spec.q));
+        double vertexRadius = tanh(acosh(coshR) / 2);
+        // the inradius r: cosh r = cos(pi / q) / sin(pi / p)
+        double midpointRadius = tanh(acosh(cos(M_PI / spec.q) / sin(M_PI / p)) / 2);
+        point shift = axes ? std::polar(0.02, M_PI / (2 * p)) : point(0, 0);
+        std::vector<point> tile(axes ? 2 * p + 1 : p + 1); // the vertices, the centre, then the edge midpoints
+        for (int k = 0; k < p; k++) tile[k] = std::polar(vertexRadius, 2 * M_PI * k / p);
+        tile[p] = 0;
+        if (axes)
+            for (int k = 0; k < p; k++) tile[p + 1 + k] = std::polar(midpointRadius, M_PI * (2 * k + 1) / p);
+        for (point &z : tile) z = (z + shift) / (1.0 + std::conj(shift) * z); // a hyperbolic translation
+
+        std::map<Cell, point> tileCentres, lineMidpoints;
+        insertUnique(tileCentres, tile[p], 1e-6);
+        std::deque<std::vector<point>> ring(1, tile);
+        for (int layer = 0; layer <= spec.depth && !ring.empty(); layer++) {
+            std::deque<std::vector<point>> next;
+            for (const std::vector<point> &current : ring) {
+                if (axes)
+                    for (int k = 0; k < p; k++)
+                        for (int end : {k, p + 1 + k}) { // through a vertex and through an edge midpoint
+                            Geodesic axis = geodesicThrough(current[p], current[end]);
+                            if (axis.radius >= minRadius && closestPointInTile(current, p, axis))
+                                addGeodesic(circles, lineMidpoints, axis);
+                        }
+                for (int k = 0; k < p; k++) {
+                    Geodesic edge = geodesicThrough(current[k], current[(k + 1) % p]);
+                    if (edge.radius < minRadius) continue;
+                    if (!axes || closestPointInTile(current, p, edge)) addGeodesic(circles, lineMidpoints, edge);
+                    if (layer == spec.depth) continue;
+                    std::vector<point> neighbour(current.size());
+                    for (size_t j = 0; j < current.size(); j++) neighbour[j] = reflect(current[j], edge);
+                    if (std::abs(neighbour[0] - neighbour[1]) < minRadius) continue; // too small to be seen
+                    if (insertUnique(tileCentres, neighbour[p], 1e-6)) next.push_back(neighbour);
+                }
+            }
+            ring.swap(next);
+        }
+        return circles;
+    }
+};
+
+/**
+ * @brief Get the circles of a tiling.
+ * @param spec The tiling.
+ * @return The circles as (centre x, centre y, radius).
+ */
+inline std::vector<vec3> tilingCircles(const TilingSpec &spec) {
+    if (!spec.isDefault()) return PQTilingBuilder::build(spec);
+    std::vector<vec3> circles;
+    circles.reserve(DefaultCircleTable::count);
+    for (const CircleEntry &circle : DefaultCircleTable::circles) circles.emplace_back(circle.x, circle.y, circle.r);
+    return circles;
+}
+
+/**
+ * @brief Parses a tiling given on the command line.
+ * @param text "P,Q" or "P,Q,DEPTH", or "default" for the Circle Limit pattern.
+ * @param spec The tiling, the depth is 4 if it is not given.
+ * @return True if the text is a hyperbolic tiling.
+ */
+inline bool parseTilingSpec(const std::string &text, TilingSpec &spec) {
+    if (text == "default") {
+        spec = TilingSpec();
+        return true;
+    }
+    int p = 0, q = 0, depth = 4;
+    if (sscanf(text.c_str(), "%d,%d,%d", &p, &q, &depth) < 2 || p <= 0 || depth < 0) return false;
+    spec = TilingSpec(p, q, depth);
+    return spec.isHyperbolic();
+}
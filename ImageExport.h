@@ -0,0 +1,516 @@
+//=============================================================================================
+// ImageExport: writers that stream texel classes into PPM, PNG and TIFF files band by band
+//=============================================================================================
+#pragma once
+#include "PoincareGenerator.h"
+#include <string>
+#include <cctype>
+
+/**
+ * @class ImageWriter
+ * @brief Writes an image of texel classes to a file, a band of rows at a time.
+ *
+ * @details The rows are written in order and none of them is kept after writeRows returns, so the memory used
+ * does not depend on the height of the image. The colours are those of classColor.
+ */
+class ImageWriter {
+protected:
+    FILE *file = nullptr; ///< The file being written.
+    int width = 0;        ///< The width of the image.
+    int height = 0;       ///< The height of the image.
+    int rowsWritten = 0;  ///< The number of rows written so far.
+    unsigned long long bytesWritten = 0; ///< The number of bytes written to the file so far.
+
+    /**
+     * @brief Writes bytes to the file.
+     * @param data The bytes.
+     * @param size The number of bytes.
+     * @return True if all bytes were written.
+     */
+    bool put(const void *data, size_t size) {
+        bytesWritten += size;
+        return fwrite(data, 1, size, file) == size;
+    }
+
+    /**
+     * @brief Get a colour channel of a texel class as a byte.
+     * @param texelClass The texel class.
+     * @param channel 0, 1 or 2 for red, green or blue.
+     * @return The channel in [0, 255].
+     */
+    static unsigned char channel(unsigned char texelClass, int channel) {
+        return static_cast<unsigned char>(classColor(texelClass)[channel] * 255);
+    }
+
+    /**
+     * @brief Writes whatever the format needs in front of the rows.
+     * @return True on success.
+     */
+    virtual bool writeHeader() = 0;
+
+    /**
+     * @brief Writes rows of texel classes.
+     * @param classes The texel classes, row by row.
+     * @param rowCount The number of rows.
+     * @return True on success.
+     */
+    virtual bool writeBand(const unsigned char *classes, int rowCount) = 0;
+
+    /**
+     * @brief Writes whatever the format needs after the rows.
+     * @return True on success.
+     */
+    virtual bool writeTrailer() { return true; }
+
+public:
+    ImageWriter() = default;
+    ImageWriter(const ImageWriter &) = delete;
+    ImageWriter &operator=(const ImageWriter &) = delete;
+
+    /**
+     * @brief Destructor, closes the file if close was not called.
+     */
+    virtual ~ImageWriter() {
+        if (file) fclose(file);
+    }
+
+    /**
+     * @brief Creates the file and writes the header.
+     * @param fileName The name of the file.
+     * @param imageWidth The width of the image.
+     * @param imageHeight The height of the image.
+     * @return True on success.
+     */
+    bool open(const std::string &fileName, int imageWidth, int imageHeight) {
+        file = fopen(fileName.c_str(), "wb");
+        if (!file) {
+            printf("Cannot create %s\n", fileName.c_str());
+            return false;
+        }
+        setvbuf(file, nullptr, _IOFBF, 1 << 20);
+        width = imageWidth;
+        height = imageHeight;
+        rowsWritten = 0;
+        bytesWritten = 0;
+        return writeHeader();
+    }
+
+    /**
+     * @brief Appends rows to the image.
+     * @param classes The texel classes, row by row.
+     * @param rowCount The number of rows.
+     * @return True on success.
+     */
+    bool writeRows(const unsigned char *classes, int rowCount) {
+        if (rowsWritten + rowCount > height) {
+            printf("More rows written than the image has\n");
+            return false;
+        }
+        rowsWritten += rowCount;
+        return writeBand(classes, rowCount);
+    }
+
+    /**
+     * @brief Writes the trailer after the last row and closes the file.
+     * @return True if the whole image was written.
+     */
+    bool close() {
+        bool ok = rowsWritten == height && writeTrailer();
+        if (fclose(file) != 0) ok = false;
+        file = nullptr;
+        return ok;
+    }
+};
+
+/**
+ * @class PpmWriter
+ * @brief Writes binary PPM (P6) images, three bytes per pixel.
+ */
+class PpmWriter : public ImageWriter {
+    std::vector<unsigned char> rgb; ///< One band converted to RGB.
+
+    bool writeHeader() override {
+        return fprintf(file, "P6\n%d %d\n255\n", width, height) > 0;
+    }
+
+    bool writeBand(const unsigned char *classes, int rowCount) override {
+        size_t count = (size_t)width * rowCount;
+        rgb.resize(3 * count);
+        for (size_t i = 0; i < count; i++) {
+            for (int c = 0; c < 3; c++) rgb[3 * i + c] = channel(classes[i], c);
+        }
+        return put(rgb.data(), rgb.size());
+    }
+};
+
+/**
+ * @class PngWriter
+ * @brief Writes indexed PNG images with two bits per pixel.
+ *
+ * @details The three texel classes are the palette, so four pixels fit into a byte. Every row uses the Up filter,
+ * which turns the rows that agree with the row above into runs of zeros. The zlib stream is compressed with fixed
+ * Huffman codes and matches at distance 1, that is run-length encoding, which is all the long runs of the tiling
+ * need. Every band becomes one deflate block in its own IDAT chunk.
+ */
+class PngWriter : public ImageWriter {
+    std::vector<unsigned char> previousRow; ///< The last packed row of the previous band, for the Up filter.
+    std::vector<unsigned char> filtered;    ///< The filtered rows of one band.
+    std::vector<unsigned char> compressed;  ///< The deflate output of one band.
+    unsigned long bitBuffer = 0; ///< Bits not yet written to compressed, the first one in the lowest bit.
+    int bitCount = 0;            ///< The number of bits in bitBuffer.
+    unsigned long adler = 1;     ///< The Adler-32 checksum of the uncompressed stream.
+    bool zlibHeaderWritten = false; ///< The two-byte zlib header has been written.
+
+    /**
+     * @brief Updates a CRC-32 with bytes.
+     * @param crc The CRC, start with 0.
+     * @param data The bytes.
+     * @param size The number of bytes.
+     * @return The new CRC.
+     */
+    static unsigned long crc32(unsigned long crc, const unsigned char *data, size_t size) {
+        static unsigned long table[256];
+        static bool tableReady = false;
+        if (!tableReady) {
+            for (unsigned long n = 0; n < 256; n++) {
+                unsigned long c = n;
+                for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+                table[n] = c;
+            }
+            tableReady = true;
+        }
+        crc ^= 0xFFFFFFFFUL;
+        for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return crc ^ 0xFFFFFFFFUL;
+    }
+
+    /**
+     * @brief Stores a 32-bit value big-endian.
+     * @param out The four bytes.
+     * @param value The value.
+     */
+    static void bigEndian(unsigned char *out, unsigned long value) {
+        out[0] = static_cast<unsigned char>(value >> 24);
+        out[1] = static_cast<unsigned char>(value >> 16);
+        out[2] = static_cast<unsigned char>(value >> 8);
+        out[3] = static_cast<unsigned char>(value);
+    }
+
+    /**
+     * @brief Writes a PNG chunk with its length and CRC.
+     * @param type The four letters of the chunk type.
+     * @param data The data of the chunk.
+     * @param size The number of bytes of data.
+     * @return True on success.
+     */
+    bool putChunk(const char *type, const unsigned char *data, size_t size) {
+        unsigned char length[4], crc[4];
+        bigEndian(length, static_cast<unsigned long>(size));
+        unsigned long sum = crc32(0, reinterpret_cast<const unsigned char *>(type), 4);
+        bigEndian(crc, crc32(sum, data, size));
+        return put(length, 4) && put(type, 4) && (size == 0 || put(data, size)) && put(crc, 4);
+    }
+
+    /**
+     * @brief Appends bits to the deflate output, the lowest bit first.
+     * @param bits The bits.
+     * @param count The number of bits, at most 16.
+     */
+    void putBits(unsigned long bits, int count) {
+        bitBuffer |= bits << bitCount;
+        bitCount += count;
+        while (bitCount >= 8) {
+            compressed.push_back(static_cast<unsigned char>(bitBuffer));
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
+    }
+
+    /**
+     * @brief Appends a Huffman code to the deflate output, which stores codes with the highest bit first.
+     * @param code The code.
+     * @param length The number of bits of the code.
+     */
+    void putCode(unsigned long code, int length) {
+        unsigned long reversed = 0;
+        for (int i = 0; i < length; i++) reversed |= ((code >> i) & 1) << (length - 1 - i);
+        putBits(reversed, length);
+    }
+
+    /**
+     * @brief Appends a literal/length symbol with its fixed Huffman code.
+     * @param symbol The symbol, 0 to 287.
+     */
+    void putSymbol(int symbol) {
+        if (symbol < 144) putCode(0x30 + symbol, 8);
+        else if (symbol < 256) putCode(0x190 + symbol - 144, 9);
+        else if (symbol < 280) putCode(symbol - 256, 7);
+        else putCode(0xC0 + symbol - 280, 8);
+    }
+
+    /**
+     * @brief Appends a match of the previous byte repeated.
+     * @param length The length of the match, 3 to 258.
+     */
+    void putRun(int length) {
+        static const int base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                     35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const int extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        int code = 28;
+        while (base[code] > length) code--;
+        putSymbol(257 + code);
+        putBits(static_cast<unsigned long>(length - base[code]), extra[code]);
+        putCode(0, 5); // distance 1
+    }
+
+    /**
+     * @brief Compresses bytes into one fixed Huffman block of the deflate stream.
+     * @param data The bytes.
+     * @param size The number of bytes.
+     * @param final True for the last block of the stream.
+     */
+    void deflateBlock(const unsigned char *data, size_t size, bool final) {
+        putBits(final ? 1 : 0, 1);
+        putBits(1, 2); // fixed Huffman codes
+        size_t i = 0;
+        while (i < size) {
+            putSymbol(data[i]);
+            size_t run = i + 1;
+            while (run < size && data[run] == data[i]) run++;
+            size_t repeats = run - i - 1;
+            while (repeats >= 3) {
+                int length = static_cast<int>(std::min<size_t>(repeats, 258));
+                putRun(length);
+                repeats -= length;
+            }
+            for (; repeats > 0; repeats--) putSymbol(data[i]);
+            i = run;
+        }
+        putSymbol(256); // end of block
+    }
+
+    /**
+     * @brief Updates the Adler-32 checksum with bytes.
+     * @param data The bytes.
+     * @param size The number of bytes.
+     */
+    void updateAdler(const unsigned char *data, size_t size) {
+        unsigned long a = adler & 0xFFFF, b = adler >> 16;
+        while (size > 0) {
+            size_t chunk = std::min<size_t>(size, 5552); // largest that cannot overflow 32 bits
+            for (size_t i = 0; i < chunk; i++) {
+                a += data[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+            data += chunk;
+            size -= chunk;
+        }
+        adler = (b << 16) | a;
+    }
+
+    bool writeHeader() override {
+        static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        unsigned char header[13] = {0};
+        bigEndian(header, static_cast<unsigned long>(width));
+        bigEndian(header + 4, static_cast<unsigned long>(height));
+        header[8] = 2; // bits per pixel
+        header[9] = 3; // indexed colour
+        unsigned char palette[9];
+        for (int i = 0; i < 9; i++) palette[i] = channel(static_cast<unsigned char>(i / 3), i % 3);
+        previousRow.assign((size_t)(width + 3) / 4, 0);
+        adler = 1;
+        bitBuffer = 0;
+        bitCount = 0;
+        zlibHeaderWritten = false;
+        return put(signature, 8) && putChunk("IHDR", header, 13) && putChunk("PLTE", palette, 9);
+    }
+
+    bool writeBand(const unsigned char *classes, int rowCount) override {
+        size_t rowBytes = previousRow.size();
+        filtered.assign((rowBytes + 1) * rowCount, 0);
+        std::vector<unsigned char> packed(rowBytes);
+        for (int row = 0; row < rowCount; row++) {
+            const unsigned char *texels = classes + (size_t)row * width;
+            std::fill(packed.begin(), packed.end(), 0);
+            for (int x = 0; x < width; x++) packed[x / 4] |= texels[x] << (6 - 2 * (x % 4));
+            unsigned char *out = filtered.data() + row * (rowBytes + 1);
+            out[0] = 2; // Up filter
+            for (size_t i = 0; i < rowBytes; i++) out[i + 1] = static_cast<unsigned char>(packed[i] - previousRow[i]);
+            previousRow.swap(packed);
+        }
+        updateAdler(filtered.data(), filtered.size());
+        compressed.clear();
+        if (!zlibHeaderWritten) {
+            compressed.push_back(0x78);
+            compressed.push_back(0x01);
+            zlibHeaderWritten = true;
+        }
+        deflateBlock(filtered.data(), filtered.size(), false);
+        return putChunk("IDAT", compressed.data(), compressed.size());
+    }
+
+    bool writeTrailer() override {
+        compressed.clear();
+        deflateBlock(nullptr, 0, true);
+        if (bitCount > 0) putBits(0, 8 - bitCount);
+        unsigned char checksum[4];
+        bigEndian(checksum, adler);
+        compressed.insert(compressed.end(), checksum, checksum + 4);
+        return putChunk("IDAT", compressed.data(), compressed.size()) && putChunk("IEND", nullptr, 0);
+    }
+};
+
+/**
+ * @class TiffWriter
+ * @brief Writes uncompressed baseline TIFF images with a 4-bit palette.
+ *
+ * @details The rows are written right after the 8-byte header, and the directory with the strip offsets follows
+ * them, so the file is written front to back without seeking. Classic TIFF is limited to 4 GB, which is 65535^2
+ * pixels at half a byte each.
+ */
+class TiffWriter : public ImageWriter {
+    static const int rowsPerStrip = 64; ///< The number of rows of a strip.
+    std::vector<unsigned char> packed;  ///< One band packed to two pixels per byte.
+
+    /**
+     * @brief Stores a 16-bit value little-endian.
+     * @param out The two bytes.
+     * @param value The value.
+     */
+    static void little16(unsigned char *out, unsigned long value) {
+        out[0] = static_cast<unsigned char>(value);
+        out[1] = static_cast<unsigned char>(value >> 8);
+    }
+
+    /**
+     * @brief Stores a 32-bit value little-endian.
+     * @param out The four bytes.
+     * @param value The value.
+     */
+    static void little32(unsigned char *out, unsigned long value) {
+        little16(out, value & 0xFFFF);
+        little16(out + 2, value >> 16);
+    }
+
+    /**
+     * @brief Get the number of bytes of a packed row.
+     * @return The number of bytes.
+     */
+    size_t rowBytes() const { return (size_t)(width + 1) / 2; }
+
+    /**
+     * @brief Get the end of the rows, the header of 8 bytes followed by the packed rows.
+     * @return The offset in bytes.
+     */
+    unsigned long long rowsEnd() const { return 8 + (unsigned long long)rowBytes() * height; }
+
+    /**
+     * @brief Get the offset of the directory, right after the rows and padded to a word boundary.
+     * @return The offset in bytes.
+     */
+    unsigned long long directoryOffset() const { return rowsEnd() + (rowsEnd() & 1); }
+
+    bool writeHeader() override {
+        int strips = (height + rowsPerStrip - 1) / rowsPerStrip;
+        unsigned long long size = directoryOffset() + 2 + 15 * 12 + 4 + 8ULL * strips + 16 + 2 * 48;
+        if (size > 0xFFFFFFFFULL) {
+            printf("A %d x %d image does not fit into a classic TIFF file, export a PNG or PPM instead\n",
+                   width, height);
+            return false;
+        }
+        unsigned char header[8] = {'I', 'I', 42, 0};
+        little32(header + 4, static_cast<unsigned long>(directoryOffset()));
+        return put(header, 8);
+    }
+
+    bool writeBand(const unsigned char *classes, int rowCount) override {
+        size_t bytes = rowBytes();
+        packed.assign(bytes * rowCount, 0);
+        for (int row = 0; row < rowCount; row++) {
+            const unsigned char *texels = classes + (size_t)row * width;
+            unsigned char *out = packed.data() + row * bytes;
+            for (int x = 0; x < width; x++) out[x / 2] |= texels[x] << (x % 2 ? 0 : 4);
+        }
+        return put(packed.data(), packed.size());
+    }
+
+    bool writeTrailer() override {
+        unsigned long offset = static_cast<unsigned long>(directoryOffset());
+        if (rowsEnd() & 1) { // the directory starts on a word boundary
+            unsigned char pad = 0;
+            if (!put(&pad, 1)) return false;
+        }
+        if (bytesWritten != offset) { // the header points at the directory
+            printf("TIFF directory at %llu instead of %lu\n", bytesWritten, offset);
+            return false;
+        }
+        const int entryCount = 15;
+        int strips = (height + rowsPerStrip - 1) / rowsPerStrip;
+        unsigned long arrays = offset + 2 + entryCount * 12 + 4; // the values that do not fit into the entries
+        unsigned long stripOffsets = arrays, stripSizes = arrays + 4 * strips;
+        unsigned long resolution = stripSizes + 4 * strips, colorMap = resolution + 16;
+
+        std::vector<unsigned char> directory(2 + entryCount * 12 + 4, 0);
+        little16(directory.data(), entryCount);
+        int entry = 0;
+        auto add = [&](unsigned long tag, unsigned long type, unsigned long count, unsigned long value) {
+            unsigned char *out = directory.data() + 2 + 12 * entry++;
+            little16(out, tag);
+            little16(out + 2, type);
+            little32(out + 4, count);
+            if (type == 3 && count == 1) little16(out + 8, value);
+            else little32(out + 8, value);
+        };
+        const unsigned long SHORT = 3, LONG = 4, RATIONAL = 5;
+        add(256, LONG, 1, static_cast<unsigned long>(width));  // ImageWidth
+        add(257, LONG, 1, static_cast<unsigned long>(height)); // ImageLength
+        add(258, SHORT, 1, 4);                                 // BitsPerSample
+        add(259, SHORT, 1, 1);                                 // Compression: none
+        add(262, SHORT, 1, 3);                                 // PhotometricInterpretation: palette
+        add(273, LONG, strips, strips == 1 ? 8 : stripOffsets); // StripOffsets
+        add(277, SHORT, 1, 1);                                 // SamplesPerPixel
+        add(278, LONG, 1, rowsPerStrip);                       // RowsPerStrip
+        add(279, LONG, strips, strips == 1 ? static_cast<unsigned long>(rowBytes() * height) : stripSizes);
+        add(282, RATIONAL, 1, resolution);                     // XResolution
+        add(283, RATIONAL, 1, resolution + 8);                 // YResolution
+        add(284, SHORT, 1, 1);                                 // PlanarConfiguration: chunky
+        add(296, SHORT, 1, 2);                                 // ResolutionUnit: inch
+        add(320, SHORT, 48, colorMap);                         // ColorMap
+        add(339, SHORT, 1, 1);                                 // SampleFormat: unsigned
+        if (!put(directory.data(), directory.size())) return false;
+
+        std::vector<unsigned char> values(8 * (size_t)strips + 16 + 2 * 48, 0);
+        for (int strip = 0; strip < strips; strip++) {
+            int rows = std::min(height - strip * rowsPerStrip, 0 + rowsPerStrip);
+            little32(values.data() + 4 * strip, static_cast<unsigned long>(8 + rowBytes() * strip * rowsPerStrip));
+            little32(values.data() + 4 * (strips + strip), static_cast<unsigned long>(rowBytes() * rows));
+        }
+        unsigned char *rational = values.data() + 8 * strips;
+        for (int i = 0; i < 2; i++) {
+            little32(rational + 8 * i, 300);
+            little32(rational + 8 * i + 4, 1);
+        }
+        unsigned char *map = rational + 16; // all reds, then all greens, then all blues, 16 bits each
+        for (int c = 0; c < 3; c++) {
+            for (int index = 0; index < 3; index++) little16(map + 2 * (16 * c + index), channel(index, c) * 257UL);
+        }
+        return put(values.data(), values.size());
+    }
+};
+
+/**
+ * @brief Creates the writer for the format of a file name extension.
+ * @param fileName The name of the file, ending in .ppm, .png, .tif or .tiff.
+ * @return The writer, nullptr for an unknown extension.
+ */
+inline std::unique_ptr<ImageWriter> imageWriterFor(const std::string &fileName) {
+    std::string extension = fileName.substr(fileName.find_last_of('.') + 1);
+    for (char &c : extension) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    if (extension == "ppm") return std::unique_ptr<ImageWriter>(new PpmWriter);
+    if (extension == "png") return std::unique_ptr<ImageWriter>(new PngWriter);
+    if (extension == "tif" || extension == "tiff") return std::unique_ptr<ImageWriter>(new TiffWriter);
+    return nullptr;
+}
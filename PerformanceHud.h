@@ -0,0 +1,258 @@
+//=============================================================================================
+// PerformanceHud: rolling frame statistics, GPU timer queries and their on-screen overlay
+//=============================================================================================
+#pragma once
+#include "framework.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+/**
+ * @brief Get a monotonic time stamp.
+ * @return The time in milliseconds since an arbitrary point.
+ */
+inline double timestampMs() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @class RollingStats
+ * @brief The minimum, mean and 99th percentile of the last values of a measurement.
+ */
+class RollingStats {
+    std::vector<double> values; ///< The last values, used as a ring buffer.
+    size_t next = 0;            ///< The index the next value is stored at.
+    size_t count = 0;           ///< The number of values stored, at most the capacity.
+
+public:
+    /**
+     * @brief Constructor.
+     * @param capacity The number of values the statistics are taken over.
+     */
+    explicit RollingStats(size_t capacity = 120) : values(capacity) {}
+
+    /**
+     * @brief Adds a value, replacing the oldest one once the buffer is full.
+     * @param value The value.
+     */
+    void add(double value) {
+        values[next] = value;
+        next = (next + 1) % values.size();
+        count = std::min(count + 1, values.size());
+    }
+
+    /**
+     * @brief Checks whether any value has been added.
+     * @return True if there are no values.
+     */
+    bool empty() const { return count == 0; }
+
+    /**
+     * @brief Get the most recently added value.
+     * @return The value, 0 if there is none.
+     */
+    double last() const { return count == 0 ? 0 : values[(next + values.size() - 1) % values.size()]; }
+
+    /**
+     * @brief Get the smallest of the values.
+     * @return The minimum, 0 if there are no values.
+     */
+    double min() const {
+        return count == 0 ? 0 : *std::min_element(values.begin(), values.begin() + count);
+    }
+
+    /**
+     * @brief Get the mean of the values.
+     * @return The mean, 0 if there are no values.
+     */
+    double mean() const {
+        double sum = 0;
+        for (size_t i = 0; i < count; i++) sum += values[i];
+        return count == 0 ? 0 : sum / count;
+    }
+
+    /**
+     * @brief Get a percentile of the values.
+     * @param fraction The fraction of values that are at most the result, e.g. 0.99.
+     * @return The percentile, 0 if there are no values.
+     */
+    double percentile(double fraction) const {
+        if (count == 0) return 0;
+        std::vector<double> sorted(values.begin(), values.begin() + count);
+        size_t rank = std::min(count - 1, static_cast<size_t>(fraction * count));
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        return sorted[rank];
+    }
+
+    /**
+     * @brief Formats the statistics for the overlay.
+     * @param name The name of the measurement.
+     * @return Name, min, mean and 99th percentile in milliseconds.
+     */
+    std::string format(const char *name) const {
+        char line[128];
+        snprintf(line, sizeof(line), "%-14s %7.2f %7.2f %7.2f ms", name, min(), mean(), percentile(0.99));
+        return line;
+    }
+};
+
+/**
+ * @class GpuTimer
+ * @brief Measures the GPU time of a pass with GL_TIME_ELAPSED queries.
+ *
+ * @details Two query objects are used in turns. The result of a frame is read back one frame later, when the
+ * other query is being issued, and only if it is already available, so reading the timer never stalls the
+ * pipeline. A result that is not available when its query is needed again is dropped.
+ */
+class GpuTimer {
+    unsigned int queries[2] = {0, 0}; ///< The query objects used in turns.
+    bool issued[2] = {false, false};  ///< The query has been issued and its result is not read yet.
+    int current = 0;                  ///< The query of the current frame.
+
+public:
+    RollingStats stats; ///< The measured times in milliseconds.
+
+    GpuTimer() = default;
+    GpuTimer(const GpuTimer &) = delete;
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    /**
+     * @brief Destructor, deletes the query objects.
+     */
+    ~GpuTimer() {
+        if (queries[0] != 0) glDeleteQueries(2, queries);
+    }
+
+    /**
+     * @brief Starts timing the pass of this frame and collects the result of the previous frame if it is ready.
+     */
+    void begin() {
+        if (queries[0] == 0) glGenQueries(2, queries);
+        int previous = 1 - current;
+        if (issued[previous]) {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(queries[previous], GL_QUERY_RESULT, &nanoseconds);
+                stats.add(static_cast<double>(nanoseconds) / 1e6);
+                issued[previous] = false;
+            }
+        }
+        issued[current] = false; // a result that was never read is dropped
+        glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+    }
+
+    /**
+     * @brief Stops timing the pass of this frame.
+     */
+    void end() {
+        glEndQuery(GL_TIME_ELAPSED);
+        issued[current] = true;
+        current = 1 - current;
+    }
+};
+
+/**
+ * @class PerformanceHud
+ * @brief Collects the frame statistics and shows them on top of the scene.
+ *
+ * @details The text is drawn with glutBitmapCharacter, which needs the fixed-function raster position of a
+ * compatibility context. In a core profile context that draws nothing, so there the summary goes into the window
+ * title instead.
+ */
+class PerformanceHud {
+    bool visible = false;        ///< The overlay is shown.
+    double lastFrameStart = 0;   ///< The time stamp of the start of the previous frame.
+    double lastTitleUpdate = 0;  ///< The time stamp of the last window title update.
+    int textSupported = -1;      ///< 1 if glutBitmapCharacter works in this context, -1 if not checked yet.
+
+    /**
+     * @brief Checks whether the context has the fixed-function raster position the bitmap font needs.
+     * @return True in a compatibility or pre-3.2 context.
+     */
+    static bool compatibilityContext() {
+        GLint major = 0, minor = 0, mask = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        if (major < 3 || (major == 3 && minor < 2)) return true;
+        glGetIntegerv(GL_CONTEXT_PROFILE_MASK, &mask);
+        return (mask & GL_CONTEXT_COMPATIBILITY_PROFILE_BIT) != 0;
+    }
+
+public:
+    RollingStats frameTime;   ///< The time between the starts of two frames in milliseconds.
+    RollingStats displayTime; ///< The CPU time of onDisplay in milliseconds.
+    RollingStats idleTime;    ///< The CPU time of onIdle in milliseconds.
+    GpuTimer uploadPass;      ///< The GPU time of swapping in a texture finished in the background.
+    GpuTimer starPass;        ///< The GPU time of drawing the star.
+    GpuTimer hudPass;         ///< The GPU time of drawing the overlay.
+
+    /**
+     * @brief Shows or hides the overlay.
+     */
+    void toggle() {
+        visible = !visible;
+        if (!visible) glutSetWindowTitle("Circle Limit");
+    }
+
+    /**
+     * @brief Checks whether the overlay is shown.
+     * @return True if the overlay is shown.
+     */
+    bool isVisible() const { return visible; }
+
+    /**
+     * @brief Records the start of a frame for the frame rate.
+     */
+    void frameStarted() {
+        double now = timestampMs();
+        if (lastFrameStart > 0) frameTime.add(now - lastFrameStart);
+        lastFrameStart = now;
+    }
+
+    /**
+     * @brief Draws the overlay, or puts its summary into the window title.
+     * @param lines The lines about the texture, drawn below the timings.
+     */
+    void draw(const std::vector<std::string> &lines) {
+        if (!visible) return;
+        double fps = frameTime.mean() > 0 ? 1000 / frameTime.mean() : 0;
+        if (textSupported < 0) textSupported = compatibilityContext() ? 1 : 0;
+        if (!textSupported) {
+            double now = timestampMs();
+            if (now - lastTitleUpdate < 250) return;
+            lastTitleUpdate = now;
+            char title[256];
+            snprintf(title, sizeof(title), "%.1f fps | display %.2f ms | star GPU %.2f ms | %s", fps,
+                     displayTime.mean(), starPass.stats.mean(), lines.empty() ? "" : lines[0].c_str());
+            glutSetWindowTitle(title);
+            return;
+        }
+
+        std::vector<std::string> text;
+        char line[128];
+        snprintf(line, sizeof(line), "%.1f fps            min     avg     p99", fps);
+        text.push_back(line);
+        text.push_back(frameTime.format("frame"));
+        text.push_back(displayTime.format("onDisplay CPU"));
+        text.push_back(idleTime.format("onIdle CPU"));
+        text.push_back(uploadPass.stats.format("upload GPU"));
+        text.push_back(starPass.stats.format("star GPU"));
+        text.push_back(hudPass.stats.format("overlay GPU"));
+        text.insert(text.end(), lines.begin(), lines.end());
+
+#if !defined(__APPLE__) // only core profile contexts there
+        hudPass.begin();
+        glUseProgram(0); // the bitmap goes through the fixed-function pipeline
+        glColor3f(1.0f, 1.0f, 1.0f);
+        int y = static_cast<int>(windowHeight) - 16;
+        for (const std::string &textLine : text) {
+            glWindowPos2i(8, y);
+            for (char c : textLine) glutBitmapCharacter(GLUT_BITMAP_8_BY_13, c);
+            y -= 15;
+        }
+        hudPass.end();
+#endif
+    }
+};
@@ -0,0 +1,1391 @@
+//=============================================================================================
+// PoincareGenerator: the CPU generation of the Circle Limit texture, usable without a GL context
+//=============================================================================================
+#pragma once
+#include "framework.h"
+#include "HyperbolicTiling.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * @class WorkerPool
+ * @brief A persistent pool of worker threads with work stealing.
+ *
+ * @details A parallel job is split into numbered tasks that are dealt out round-robin to one queue per thread.
+ * Every thread takes tasks from the front of its own queue and, once that is empty, steals from the back of the
+ * other queues, so threads that got cheap tasks help out with the expensive ones. The calling thread takes part
+ * in the work, and the worker threads sleep between jobs instead of being created for each one.
+ */
+class WorkerPool {
+    /**
+     * @struct TaskQueue
+     * @brief The task indices waiting to be run by one thread.
+     */
+    struct TaskQueue {
+        std::mutex mutex;      ///< Guards the tasks.
+        std::deque<int> tasks; ///< Indices of the tasks that are not taken yet.
+    };
+
+    std::vector<std::thread> workers; ///< The worker threads, the calling thread is not among them.
+    std::vector<std::unique_ptr<TaskQueue>> queues; ///< One queue per thread, index 0 belongs to the caller.
+    std::mutex jobMutex;   ///< Lets only one parallelFor run at a time.
+    std::mutex stateMutex; ///< Guards the job state below.
+    std::condition_variable wakeUp;  ///< Signals the workers that a job has started or the pool is stopping.
+    std::condition_variable jobDone; ///< Signals the caller that a worker has finished.
+    const std::function<void(int)> *job = nullptr; ///< The body of the running job.
+    unsigned long jobGeneration = 0; ///< Incremented for every job, so that workers do not run one twice.
+    int remainingTasks = 0; ///< The number of tasks of the running job that have not finished yet.
+    int activeWorkers = 0;  ///< The number of workers that are still busy with the running job.
+    bool stopping = false;  ///< Tells the workers to exit.
+    int threadCount = 1;    ///< The number of threads working on a job, including the caller.
+
+    /**
+     * @brief Takes the next task, first from the own queue, then from the others.
+     * @param self The index of the queue of the calling thread.
+     * @param task The index of the task that was taken.
+     * @return True if a task was taken, false if all queues are empty.
+     */
+    bool takeTask(int self, int &task) {
+        {
+            TaskQueue &own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+        int n = static_cast<int>(queues.size());
+        for (int i = 1; i < n; i++) {
+            TaskQueue &victim = *queues[(self + i) % n];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Runs tasks of the current job until there are none left.
+     * @param self The index of the queue of the calling thread.
+     * @param body The body of the job, read under stateMutex when the thread joined it.
+     */
+    void work(int self, const std::function<void(int)> &body) {
+        int task;
+        while (takeTask(self, task)) {
+            body(task);
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (--remainingTasks == 0) jobDone.notify_all();
+        }
+    }
+
+    /**
+     * @brief The main loop of a worker thread.
+     *
+     * @details A worker that wakes up late, after its job has finished, finds no job and goes back to sleep; the
+     * tasks of a job are only queued once the job is set, so a worker that has joined it runs only its tasks.
+     *
+     * @param self The index of the queue of the worker.
+     */
+    void workerLoop(int self) {
+        TraceRecorder::instance().nameThread("worker " + std::to_string(self));
+        unsigned long seenGeneration = 0;
+        while (true) {
+            const std::function<void(int)> *body;
+            {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                wakeUp.wait(lock, [&] { return stopping || jobGeneration != seenGeneration; });
+                if (stopping) return;
+                seenGeneration = jobGeneration;
+                if (!job) continue; // the job of this generation has already finished
+                body = job;
+                activeWorkers++;
+            }
+            work(self, *body);
+            std::lock_guard<std::mutex> lock(stateMutex);
+            activeWorkers--;
+            jobDone.notify_all();
+        }
+    }
+
+    /**
+     * @brief Stops and joins all worker threads.
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (auto &worker : workers) worker.join();
+        workers.clear();
+        stopping = false;
+    }
+
+public:
+    /**
+     * @brief Construct a pool that runs everything on the calling thread until setThreadCount is called.
+     */
+    WorkerPool() { queues.emplace_back(new TaskQueue); }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    /**
+     * @brief Sets the number of threads that work on a job, including the calling thread.
+     * @param count The number of threads, values below 1 mean 1.
+     */
+    void setThreadCount(int count) {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        if (count < 1) count = 1;
+        stop();
+        queues.clear();
+        for (int i = 0; i < count; i++) queues.emplace_back(new TaskQueue);
+        for (int i = 1; i < count; i++) workers.emplace_back(&WorkerPool::workerLoop, this, i);
+        threadCount = count;
+    }
+
+    /**
+     * @brief Get the number of threads that work on a job, including the calling thread.
+     * @return The number of threads.
+     */
+    int getThreadCount() const { return threadCount; }
+
+    /**
+     * @brief Runs body(0) ... body(taskCount - 1) on the pool and waits until all of them have finished.
+     * @param taskCount The number of tasks.
+     * @param body The function to run for every task index.
+     */
+    void parallelFor(int taskCount, const std::function<void(int)> &body) {
+        std::lock_guard<std::mutex> jobLock(jobMutex);
+        if (workers.empty() || taskCount <= 1) {
+            for (int task = 0; task < taskCount; task++) body(task);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            job = &body;
+            remainingTasks = taskCount;
+            jobGeneration++;
+        }
+        for (int task = 0; task < taskCount; task++) {
+            TaskQueue &queue = *queues[task % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(task);
+        }
+        wakeUp.notify_all();
+        work(0, body);
+        std::unique_lock<std::mutex> lock(stateMutex);
+        jobDone.wait(lock, [&] { return remainingTasks == 0 && activeWorkers == 0; });
+        job = nullptr;
+    }
+
+    /**
+     * @brief Destructor, joins the worker threads.
+     */
+    ~WorkerPool() { stop(); }
+};
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CIRCLE_LIMIT_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+#if (defined(__ARM_NEON) && defined(__aarch64__)) || defined(_M_ARM64) // vsqrtq_f32 is AArch64 only
+#define CIRCLE_LIMIT_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(CIRCLE_LIMIT_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+/**
+ * @enum SimdLevel
+ * @brief The instruction sets the circle-parity kernel can be run with.
+ */
+enum SimdLevel {
+    SIMD_SCALAR, ///< The original scalar loop over the circles.
+    SIMD_SSE42,  ///< 4 circles per instruction with SSE4.2.
+    SIMD_AVX2,   ///< 8 circles per instruction with AVX2.
+    SIMD_AVX512, ///< 16 circles per instruction with AVX-512.
+    SIMD_NEON    ///< 4 circles per instruction with NEON.
+};
+
+/**
+ * @brief Get the printable name of an instruction set.
+ * @param level The instruction set.
+ * @return The name of the instruction set.
+ */
+inline const char *simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SIMD_SSE42: return "SSE4.2";
+        case SIMD_AVX2: return "AVX2";
+        case SIMD_AVX512: return "AVX-512";
+        case SIMD_NEON: return "NEON";
+        default: return "scalar";
+    }
+}
+
+/**
+ * @brief Detects the widest instruction set the processor running the program supports.
+ * @return The widest supported instruction set.
+ */
+inline SimdLevel detectSimdLevel() {
+#if defined(CIRCLE_LIMIT_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return SIMD_SSE42;
+    return SIMD_SCALAR;
+#elif defined(CIRCLE_LIMIT_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool sse42 = (info[2] & (1 << 20)) != 0;
+    bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+    bool osSavesZmm = osSavesYmm && (_xgetbv(0) & 0xE0) == 0xE0;
+    __cpuidex(info, 7, 0);
+    if (osSavesZmm && (info[1] & (1 << 16))) return SIMD_AVX512;
+    if (osSavesYmm && (info[1] & (1 << 5))) return SIMD_AVX2;
+    return sse42 ? SIMD_SSE42 : SIMD_SCALAR;
+#elif defined(CIRCLE_LIMIT_NEON)
+    return SIMD_NEON;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+/**
+ * @brief Get the instruction set a PoincareGenerator starts with.
+ *
+ * @details The x86 kernels are bit-exact with the scalar loop, see ParityKernel. On ARM the compiler may contract
+ * the scalar loop and the NEON kernel into fused multiply-adds differently, so NEON has to be selected explicitly.
+ *
+ * @return The widest supported instruction set on x86, SIMD_SCALAR elsewhere.
+ */
+inline SimdLevel defaultSimdLevel() {
+#if defined(CIRCLE_LIMIT_X86)
+    return detectSimdLevel();
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+/**
+ * @brief Checks whether the processor running the program supports an instruction set.
+ * @param level The instruction set.
+ * @return True if the kernel of the instruction set can be run.
+ */
+inline bool simdLevelSupported(SimdLevel level) {
+    SimdLevel best = detectSimdLevel();
+    if (level == SIMD_SCALAR || level == best) return true;
+    return best != SIMD_NEON && level != SIMD_NEON && level < best;
+}
+
+/**
+ * @class CircleTable
+ * @brief The circles in structure-of-arrays layout for the vectorized parity kernels.
+ *
+ * @details The centres and the radii are kept in separate arrays that are aligned to 64 bytes and padded to a
+ * multiple of 16 entries, so every kernel can run whole vectors without a remainder loop. The padding circles have
+ * a negative radius and therefore never contain a point.
+ */
+class CircleTable {
+    static const int alignment = 16; ///< Alignment and padding in floats, the width of an AVX-512 vector.
+    std::vector<float> storage; ///< The three arrays, over-allocated so that they can be aligned.
+    size_t offset = 0; ///< The index of the first aligned float in the storage.
+    int padded = 0;    ///< The number of entries in each array including the padding.
+
+public:
+    /**
+     * @brief Fills the table from circles given as (centre x, centre y, radius).
+     * @param circles The circles.
+     */
+    void build(const std::vector<vec3> &circles) {
+        padded = static_cast<int>((circles.size() + alignment - 1) / alignment * alignment);
+        storage.assign(3 * (size_t)padded + alignment, 0.0f);
+        offset = (alignment - (reinterpret_cast<uintptr_t>(storage.data()) / sizeof(float)) % alignment) % alignment;
+        float *x = cx(), *y = cy(), *radius = r();
+        for (int i = 0; i < padded; i++) {
+            if (i < static_cast<int>(circles.size())) {
+                x[i] = circles[i].x;
+                y[i] = circles[i].y;
+                radius[i] = circles[i].z;
+            } else {
+                radius[i] = -1.0f;
+            }
+        }
+    }
+
+    /**
+     * @brief Get the number of entries in each array, a multiple of 16.
+     * @return The padded number of circles.
+     */
+    int size() const { return padded; }
+
+    float *cx() { return storage.data() + offset; }                         ///< The x-coordinates of the centres.
+    float *cy() { return storage.data() + offset + padded; }                ///< The y-coordinates of the centres.
+    float *r() { return storage.data() + offset + 2 * (size_t)padded; }     ///< The radii.
+    const float *cx() const { return storage.data() + offset; }             ///< The x-coordinates of the centres.
+    const float *cy() const { return storage.data() + offset + padded; }    ///< The y-coordinates of the centres.
+    const float *r() const { return storage.data() + offset + 2 * (size_t)padded; }  ///< The radii.
+};
+
+/**
+ * @brief Get the parity of the number of set bits.
+ * @param bits The bits.
+ * @return 1 if an odd number of bits is set, 0 otherwise.
+ */
+inline int bitParity(unsigned int bits) {
+    bits ^= bits >> 16;
+    bits ^= bits >> 8;
+    bits ^= bits >> 4;
+    bits ^= bits >> 2;
+    bits ^= bits >> 1;
+    return static_cast<int>(bits & 1);
+}
+
+/**
+ * @brief A kernel that returns the parity of the number of circles containing a point.
+ *
+ * @details Every kernel computes the distance to a centre as the scalar loop of PoincareGenerator::countCircles
+ * does, with correctly rounded squares, sum and square root, and compares it to the radius with <=, so the kernels
+ * give the same texels as the scalar loop bit for bit. The AVX-512 kernel uses the intrinsics with an explicit
+ * rounding mode, which the compiler cannot contract into fused multiply-adds, and CMakeLists.txt turns contraction
+ * off for the scalar loop, which would otherwise be contracted in builds for processors with FMA.
+ */
+typedef int (*ParityKernel)(const CircleTable &table, float x, float y);
+
+#ifdef CIRCLE_LIMIT_X86
+/**
+ * @brief The parity kernel for SSE4.2, testing 4 circles per instruction.
+ */
+SIMD_TARGET("sse4.2") inline int circleParitySse42(const CircleTable &table, float x, float y) {
+    __m128 px = _mm_set1_ps(x), py = _mm_set1_ps(y), odd = _mm_setzero_ps();
+    const float *cx = table.cx(), *cy = table.cy(), *radius = table.r();
+    for (int i = 0; i < table.size(); i += 4) {
+        __m128 dx = _mm_sub_ps(px, _mm_load_ps(cx + i));
+        __m128 dy = _mm_sub_ps(py, _mm_load_ps(cy + i));
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        odd = _mm_xor_ps(odd, _mm_cmple_ps(_mm_sqrt_ps(d2), _mm_load_ps(radius + i)));
+    }
+    return bitParity(static_cast<unsigned int>(_mm_movemask_ps(odd)));
+}
+
+/**
+ * @brief The parity kernel for AVX2, testing 8 circles per instruction.
+ */
+SIMD_TARGET("avx2") inline int circleParityAvx2(const CircleTable &table, float x, float y) {
+    __m256 px = _mm256_set1_ps(x), py = _mm256_set1_ps(y), odd = _mm256_setzero_ps();
+    const float *cx = table.cx(), *cy = table.cy(), *radius = table.r();
+    for (int i = 0; i < table.size(); i += 8) {
+        __m256 dx = _mm256_sub_ps(px, _mm256_load_ps(cx + i));
+        __m256 dy = _mm256_sub_ps(py, _mm256_load_ps(cy + i));
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        odd = _mm256_xor_ps(odd, _mm256_cmp_ps(_mm256_sqrt_ps(d2), _mm256_load_ps(radius + i), _CMP_LE_OQ));
+    }
+    return bitParity(static_cast<unsigned int>(_mm256_movemask_ps(odd)));
+}
+
+/**
+ * @brief The parity kernel for AVX-512, testing 16 circles per instruction.
+ */
+SIMD_TARGET("avx512f") inline int circleParityAvx512(const CircleTable &table, float x, float y) {
+    const int nearest = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+    const __mmask16 all = 0xFFFF;
+    __m512 px = _mm512_set1_ps(x), py = _mm512_set1_ps(y);
+    __mmask16 odd = 0;
+    const float *cx = table.cx(), *cy = table.cy(), *radius = table.r();
+    for (int i = 0; i < table.size(); i += 16) {
+        __m512 dx = _mm512_sub_ps(px, _mm512_load_ps(cx + i));
+        __m512 dy = _mm512_sub_ps(py, _mm512_load_ps(cy + i));
+        // the masked forms with all lanes set, the unmasked ones trip -Wmaybe-uninitialized in the GCC headers
+        __m512 d2 = _mm512_mask_add_round_ps(dx, all, _mm512_mask_mul_round_ps(dx, all, dx, dx, nearest),
+                                             _mm512_mask_mul_round_ps(dy, all, dy, dy, nearest), nearest);
+        __m512 distance = _mm512_mask_sqrt_round_ps(d2, all, d2, nearest);
+        odd ^= _mm512_cmp_ps_mask(distance, _mm512_load_ps(radius + i), _CMP_LE_OQ);
+    }
+    return bitParity(static_cast<unsigned int>(odd));
+}
+#endif
+
+#ifdef CIRCLE_LIMIT_NEON
+/**
+ * @brief The parity kernel for NEON, testing 4 circles per instruction.
+ */
+inline int circleParityNeon(const CircleTable &table, float x, float y) {
+    float32x4_t px = vdupq_n_f32(x), py = vdupq_n_f32(y);
+    uint32x4_t odd = vdupq_n_u32(0);
+    const float *cx = table.cx(), *cy = table.cy(), *radius = table.r();
+    for (int i = 0; i < table.size(); i += 4) {
+        float32x4_t dx = vsubq_f32(px, vld1q_f32(cx + i));
+        float32x4_t dy = vsubq_f32(py, vld1q_f32(cy + i));
+        float32x4_t d2 = vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy));
+        odd = veorq_u32(odd, vcleq_f32(vsqrtq_f32(d2), vld1q_f32(radius + i)));
+    }
+    odd = vandq_u32(odd, vdupq_n_u32(1));
+    return static_cast<int>((vgetq_lane_u32(odd, 0) ^ vgetq_lane_u32(odd, 1) ^
+                             vgetq_lane_u32(odd, 2) ^ vgetq_lane_u32(odd, 3)));
+}
+#endif
+
+/**
+ * @brief Get the parity kernel for an instruction set.
+ * @param level The instruction set.
+ * @return The kernel, or nullptr for the scalar path.
+ */
+inline ParityKernel parityKernelFor(SimdLevel level) {
+    switch (level) {
+#ifdef CIRCLE_LIMIT_X86
+        case SIMD_SSE42: return circleParitySse42;
+        case SIMD_AVX2: return circleParityAvx2;
+        case SIMD_AVX512: return circleParityAvx512;
+#endif
+#ifdef CIRCLE_LIMIT_NEON
+        case SIMD_NEON: return circleParityNeon;
+#endif
+        default: return nullptr;
+    }
+}
+
+/**
+ * @enum TextureGenerator
+ * @brief The ways a PoincareTexture can be generated.
+ */
+enum TextureGenerator {
+    GENERATOR_CPU,     ///< Per-texel parity test on the CPU, see PoincareGenerator::renderRows.
+    GENERATOR_STENCIL, ///< Even/odd coverage of the circles counted by the stencil buffer on the GPU.
+    GENERATOR_SPAN,    ///< Analytic circle/row intersections filled as runs, see PoincareGenerator::renderSpanRows.
+    GENERATOR_QUADTREE,///< Quads of constant parity filled at once, see PoincareGenerator::renderQuadRows.
+    GENERATOR_DISTANCE,///< Signed distances to the edges instead of classes, see PoincareGenerator::renderDistanceRows.
+    GENERATOR_COUNT    ///< The number of generators.
+};
+
+/**
+ * @brief Get the printable name of a texture generator.
+ * @param generator The generator.
+ * @return The name of the generator.
+ */
+inline const char *textureGeneratorName(TextureGenerator generator) {
+    switch (generator) {
+        case GENERATOR_STENCIL: return "stencil";
+        case GENERATOR_SPAN: return "span";
+        case GENERATOR_QUADTREE: return "quadtree";
+        case GENERATOR_DISTANCE: return "distance field";
+        default: return "CPU";
+    }
+}
+
+/**
+ * @brief The texel classes of the generated texture.
+ */
+enum TexelClass : unsigned char {
+    CLASS_OUTSIDE = 0, ///< Outside of the Poincare disk.
+    CLASS_EVEN = 1,    ///< Inside the disk and inside an even number of circles.
+    CLASS_ODD = 2      ///< Inside the disk and inside an odd number of circles.
+};
+
+/**
+ * @brief Get the colour of a texel class.
+ * @param texelClass The texel class.
+ * @return The colour of the class.
+ */
+inline vec4 classColor(unsigned char texelClass) {
+    switch (texelClass) {
+        case CLASS_EVEN: return {1.0f, 1.0f, 0.0f, 1.0f};
+        case CLASS_ODD: return {0.0f, 0.0f, 1.0f, 1.0f};
+        default: return {0.0f, 0.0f, 0.0f, 1.0f};
+    }
+}
+
+/**
+ * @enum QuadCoverage
+ * @brief How a circle covers the texel centres of a quad of the quadtree generator.
+ */
+enum QuadCoverage {
+    QUAD_DISJOINT,  ///< The circle contains none of the texels.
+    QUAD_CONTAINED, ///< The circle contains all of the texels.
+    QUAD_STRADDLING ///< The boundary of the circle may run between the texels.
+};
+
+/**
+ * @enum TexelLayout
+ * @brief The layouts renderTexels can write the texels of a texture in.
+ */
+enum TexelLayout {
+    TEXELS_CLASSES, ///< One TexelClass byte per texel.
+    TEXELS_RGBA8    ///< The colour of the class as four bytes per texel.
+};
+
+/**
+ * @brief Get the size of a texel in a layout.
+ * @param layout The layout.
+ * @return The size of a texel in bytes.
+ */
+inline size_t texelBytes(TexelLayout layout) {
+    return layout == TEXELS_RGBA8 ? 4 : 1;
+}
+
+/**
+ * @class PoincareGenerator
+ * @brief Computes the circles of the tiling and renders them into texel classes on the CPU.
+ *
+ * @details Nothing in here touches OpenGL, so the generation can be run and measured without a window, see
+ * CircleLimitBench.cpp. PoincareTexture uploads the classes it renders.
+ */
+class PoincareGenerator {
+private:
+    TilingSpec tiling; ///< The tiling the circles belong to.
+    std::vector<vec3> circles; ///< A vector of circles.
+    CircleTable circleTable; ///< The circles in the layout of the vectorized kernels.
+    SimdLevel simdLevel = SIMD_SCALAR; ///< The instruction set used by the parity test.
+    ParityKernel parityKernel = nullptr; ///< The vectorized parity test, nullptr for the scalar one.
+    WorkerPool *pool; ///< The threads the bands are rendered on.
+
+public:
+    static const int bandHeight = 8; ///< The number of rows rendered by one task of the worker pool.
+    static const int quadBandHeight = 64; ///< The rows of a task of the quadtree generator, the height of its root.
+    static const int quadLeafSize = 8; ///< The quads of the quadtree generator small enough to be tested texel by texel.
+    static constexpr float distanceRange = 4; ///< The distance in texels the ends of a distance channel stand for.
+    static const int distanceChunk = 32;       ///< The texels of a row that share one list of nearby circles.
+
+    /**
+     * @brief Constructor, computes the circles and selects the instruction set of defaultSimdLevel.
+     * @param pool The threads the bands are rendered on.
+     * @param spec The tiling, the default Circle Limit pattern comes from a table built at compile time.
+     */
+    explicit PoincareGenerator(WorkerPool &pool, const TilingSpec &spec = TilingSpec()) : tiling(spec), pool(&pool) {
+        math();
+        setSimdLevel(defaultSimdLevel());
+    }
+
+    /**
+     * @brief Selects another tiling and computes its circles, no rendering may be running.
+     * @param spec The tiling.
+     */
+    void setTiling(const TilingSpec &spec) {
+        tiling = spec;
+        math();
+    }
+
+    /**
+     * @brief Get the tiling the circles belong to.
+     * @return The tiling.
+     */
+    const TilingSpec &getTiling() const { return tiling; }
+
+    /**
+     * @brief Get the circles of the tiling.
+     * @return The circles as (centre x, centre y, radius).
+     */
+    const std::vector<vec3> &getCircles() const { return circles; }
+
+    /**
+     * @brief Get the worker pool the bands are rendered on.
+     * @return The worker pool.
+     */
+    WorkerPool &getPool() { return *pool; }
+
+    /**
+     * @brief Calculates the distance value.
+     * @param point The point value.
+     * @param circle The circle value.
+     * @return The calculated distance value.
+     */
+    static float calculateDistance(const vec2& point, const vec3& circle) {
+        return sqrtf(powf(point.x-circle.x, 2)+powf(point.y-circle.y, 2));
+    }
+
+    /**
+     * @brief Counts the number of circles.
+     * @param point The point value.
+     * @return The number of circles.
+     */
+    int countCircles(const vec2& point){
+        int count = 0;
+        auto it = circles.begin();
+        while(it != circles.end()) {
+            if(calculateDistance(point, *it) <= it->z){
+                count++;
+            }
+            ++it;
+        }
+        return count;
+    }
+
+    /**
+     * @brief Returns the number of circles.
+     * @param point The point value.
+     * @return The number of circles.
+     */
+    int manyCircles(vec2 point){
+        return countCircles(point);
+    }
+
+    /**
+     * @brief Returns the parity of the number of circles containing a point.
+     * @param point The point value.
+     * @return 1 if the point is inside an odd number of circles, 0 otherwise.
+     */
+    int circleParity(const vec2& point) {
+        if (parityKernel) return parityKernel(circleTable, point.x, point.y);
+        return manyCircles(point) % 2;
+    }
+
+    /**
+     * @brief Selects the instruction set of the parity test.
+     *
+     * @details The vectorized kernels give the same texels as the scalar loop, see ParityKernel.
+     *
+     * @param level The requested instruction set, it falls back to scalar if the processor does not support it.
+     */
+    void setSimdLevel(SimdLevel level) {
+        if (!simdLevelSupported(level)) level = SIMD_SCALAR;
+        simdLevel = level;
+        parityKernel = parityKernelFor(level);
+    }
+
+    /**
+     * @brief Get the instruction set of the parity test.
+     * @return The instruction set.
+     */
+    SimdLevel getSimdLevel() const { return simdLevel; }
+
+    /**
+     * @brief Computes the circles of the tiling and their table for the vectorized kernels.
+     */
+    void math(){
+        TRACE_ZONE("PoincareGenerator::math");
+        circles = tilingCircles(tiling);
+        circles.shrink_to_fit();
+        circleTable.build(circles);
+    }
+
+    /**
+     * @brief Computes the class of one texel.
+     * @param xC The column of the texel.
+     * @param yC The row of the texel.
+     * @param textureWidth The width of the texture.
+     * @return The texel class.
+     */
+    unsigned char texelClass(int xC, int yC, int textureWidth) {
+        float x =(float) xC / (float)textureWidth * 2 - 1.0f;
+        float y =(float) yC / (float)textureWidth * 2 - 1.0f;
+        return pointClass(x, y);
+    }
+
+    /**
+     * @brief Computes the class of a point of the disk coordinates.
+     * @param x The x-coordinate of the point.
+     * @param y The y-coordinate of the point.
+     * @return The texel class of the point.
+     */
+    unsigned char pointClass(float x, float y) {
+        if(sqrt(pow(x, 2) + pow(y, 2)) > 1) {
+            return CLASS_OUTSIDE;
+        }
+        int parity = circleParity(vec2(x, y));
+        if(parity == 0) {
+            return CLASS_EVEN;
+        }
+        else {
+            return CLASS_ODD;
+        }
+    }
+
+    /**
+     * @brief Renders a band of rows of the texture as texel classes.
+     * @param textureWidth The width of the texture.
+     * @param firstRow The first row of the band.
+     * @param lastRow The row after the last row of the band.
+     * @param rows The classes of the band, starting with firstRow.
+     */
+    void renderRows(int textureWidth, int firstRow, int lastRow, unsigned char *rows) {
+        int yC = firstRow;
+        while(yC < lastRow) {
+            unsigned char *texel = rows + (size_t)(yC - firstRow) * textureWidth;
+            int xC = 0;
+            while(xC < textureWidth) {
+                *texel = texelClass(xC, yC, textureWidth);
+                ++texel;
+                xC++;
+            }
+            yC++;
+        }
+    }
+
+    /**
+     * @brief Checks whether a texel of a row lies inside a circle, with the test of countCircles.
+     * @param xC The column of the texel.
+     * @param y The y-coordinate of the row.
+     * @param textureWidth The width of the texture.
+     * @param circle The circle.
+     * @return True if the texel lies inside the circle.
+     */
+    static bool texelInCircle(int xC, float y, int textureWidth, const vec3 &circle) {
+        float x = (float) xC / (float)textureWidth * 2 - 1.0f;
+        return calculateDistance(vec2(x, y), circle) <= circle.z;
+    }
+
+    /**
+     * @brief Checks whether a texel of a row lies inside the disk, with the test of texelClass.
+     * @param xC The column of the texel.
+     * @param y The y-coordinate of the row.
+     * @param textureWidth The width of the texture.
+     * @return True if the texel lies inside the disk.
+     */
+    static bool texelInDisk(int xC, float y, int textureWidth) {
+        float x = (float) xC / (float)textureWidth * 2 - 1.0f;
+        return !(sqrt(pow(x, 2) + pow(y, 2)) > 1);
+    }
+
+    /**
+     * @brief Finds the texels of a row inside a circle.
+     *
+     * @details The interval is solved analytically, then its ends are moved until they agree with the per-texel
+     * test, so that rounding in the solution cannot change the result.
+     *
+     * @param y The y-coordinate of the row.
+     * @param textureWidth The width of the texture.
+     * @param circle The circle.
+     * @param inside The per-texel test, called with the column.
+     * @param first The first texel inside.
+     * @param last The last texel inside, less than first if there is none.
+     */
+    template<typename Inside>
+    static void rowInterval(float y, int textureWidth, const vec3 &circle, Inside inside, int &first, int &last) {
+        float dy = y - circle.y;
+        float halfWidth = sqrtf(std::max(circle.z * circle.z - dy * dy, 0.0f));
+        float scale = (float)textureWidth / 2;
+        float left = std::max((circle.x - halfWidth + 1) * scale, -1.0f);
+        float right = std::min((circle.x + halfWidth + 1) * scale, (float)textureWidth);
+        last = std::min(static_cast<int>(floorf(right)), textureWidth - 1);
+        first = std::max(static_cast<int>(ceilf(left)), 0);
+        if (first > last + 1) first = last + 1;
+        while (first > 0 && inside(first - 1)) first--;
+        while (first <= last && !inside(first)) first++;
+        while (last < textureWidth - 1 && last >= first && inside(last + 1)) last++;
+        while (last >= first && !inside(last)) last--;
+    }
+
+    /**
+     * @brief Renders a part of a row of the texture as runs of constant parity.
+     *
+     * @details Every circle crosses a row in at most one interval. The ends of the intervals are sorted and the
+     * parity flips at each of them, so each run between two ends is filled with a single memset. The ends left of
+     * the part only flip the parity, so a circle that does not reach into the part changes nothing.
+     *
+     * @param textureWidth The width of the texture.
+     * @param yC The row.
+     * @param firstColumn The first column of the part.
+     * @param columns The number of columns of the part.
+     * @param rowCircles The circles that may cross the part.
+     * @param flips The ends of the intervals, a buffer reused between rows.
+     * @param row The classes of the part.
+     */
+    static void renderSpanRow(int textureWidth, int yC, int firstColumn, int columns,
+                              const std::vector<vec3> &rowCircles, std::vector<int> &flips, unsigned char *row) {
+        memset(row, CLASS_OUTSIDE, columns);
+        if (yC < 0 || yC > textureWidth) return; // row textureWidth is y = 1, its centre texel is in the disk
+        float y = (float) yC / (float)textureWidth * 2 - 1.0f;
+        int diskFirst, diskLast;
+        rowInterval(y, textureWidth, vec3(0, 0, 1), [&](int xC) { return texelInDisk(xC, y, textureWidth); },
+                    diskFirst, diskLast);
+        diskFirst = std::max(diskFirst, firstColumn);
+        diskLast = std::min(diskLast, firstColumn + columns - 1);
+        if (diskFirst > diskLast) return;
+
+        flips.clear();
+        for (const vec3 &circle : rowCircles) {
+            if (fabsf(y - circle.y) > circle.z * 1.001f + 1e-6f) continue;
+            int first, last;
+            rowInterval(y, textureWidth, circle,
+                        [&](int xC) { return texelInCircle(xC, y, textureWidth, circle); }, first, last);
+            if (first > last) continue;
+            flips.push_back(first);
+            flips.push_back(last + 1);
+        }
+        std::sort(flips.begin(), flips.end());
+
+        int parity = 0, run = diskFirst;
+        for (int flip : flips) {
+            if (flip > diskLast) break;
+            if (flip > run) {
+                memset(row + run - firstColumn, parity ? CLASS_ODD : CLASS_EVEN, flip - run);
+                run = flip;
+            }
+            parity ^= 1;
+        }
+        memset(row + run - firstColumn, parity ? CLASS_ODD : CLASS_EVEN, diskLast + 1 - run);
+    }
+
+    /**
+     * @brief Renders a band of rows of the texture as runs of constant parity.
+     *
+     * @details The texels outside the interval of the unit disk are filled the same way, see renderSpanRow. The
+     * result is the same as that of renderRows with the scalar parity test.
+     *
+     * @param textureWidth The width of the texture.
+     * @param firstRow The first row of the band.
+     * @param lastRow The row after the last row of the band.
+     * @param rows The classes of the band, starting with firstRow.
+     */
+    void renderSpanRows(int textureWidth, int firstRow, int lastRow, unsigned char *rows) const {
+        std::vector<int> flips;
+        for (int yC = firstRow; yC < lastRow; yC++)
+            renderSpanRow(textureWidth, yC, 0, textureWidth, circles, flips, rows + (size_t)(yC - firstRow) * textureWidth);
+    }
+
+    /**
+     * @brief Renders a window of a square texture with the span generator, on the calling thread only.
+     *
+     * @details Only the circles whose bounding box reaches into the window are intersected with its rows, so a
+     * small window of a huge texture, e.g. a tile of a deep level of VirtualTexture, costs about as much as a
+     * small texture. Texels of the window outside the texture are CLASS_OUTSIDE. Every texel gets the class it
+     * has in renderSpanRows of the whole texture.
+     *
+     * @param textureWidth The width and the height of the texture.
+     * @param firstColumn The first column of the window, it may be negative.
+     * @param firstRow The first row of the window, it may be negative.
+     * @param columns The width of the window.
+     * @param rows The height of the window.
+     * @param classes The classes of the window, row by row.
+     */
+    void renderSpanWindow(int textureWidth, int firstColumn, int firstRow, int columns, int rows,
+                          unsigned char *classes) const {
+        float scale = 2.0f / (float)textureWidth;
+        float left = (float)firstColumn * scale - 1, right = (float)(firstColumn + columns) * scale - 1;
+        float bottom = (float)firstRow * scale - 1, top = (float)(firstRow + rows) * scale - 1;
+        std::vector<vec3> windowCircles;
+        for (const vec3 &circle : circles) {
+            float reach = circle.z * 1.001f + 1e-6f + scale;
+            if (circle.x + reach < left || circle.x - reach > right || circle.y + reach < bottom ||
+                circle.y - reach > top) continue;
+            windowCircles.push_back(circle);
+        }
+        std::vector<int> flips;
+        for (int row = 0; row < rows; row++)
+            renderSpanRow(textureWidth, firstRow + row, firstColumn, columns, windowCircles, flips,
+                          classes + (size_t)row * columns);
+    }
+
+    /**
+     * @brief Get the disk coordinate of the centre of a texel column or row, as texelClass computes it.
+     * @param c The column or the row.
+     * @param textureWidth The width of the texture.
+     * @return The coordinate.
+     */
+    static float texelCoordinate(int c, int textureWidth) { return (float)c / (float)textureWidth * 2 - 1.0f; }
+
+    /**
+     * @brief Classifies a circle against the texel centres of a quad.
+     *
+     * @details The nearest and the farthest point of the box of the centres are compared with the radius. The margin
+     * keeps every texel whose test in texelInCircle could come out either way in a straddling quad, so the quads
+     * that are filled at once get the class the per-texel test gives each of their texels.
+     *
+     * @param circle The circle.
+     * @param left The coordinate of the first column.
+     * @param bottom The coordinate of the first row.
+     * @param right The coordinate of the last column.
+     * @param top The coordinate of the last row.
+     * @return The coverage.
+     */
+    static QuadCoverage quadCoverage(const vec3 &circle, float left, float bottom, float right, float top) {
+        float nearX = std::max(std::max(left - circle.x, circle.x - right), 0.0f);
+        float nearY = std::max(std::max(bottom - circle.y, circle.y - top), 0.0f);
+        float farX = std::max(fabsf(left - circle.x), fabsf(right - circle.x));
+        float farY = std::max(fabsf(bottom - circle.y), fabsf(top - circle.y));
+        float margin = 1e-5f * (1 + circle.z);
+        if (sqrtf(nearX * nearX + nearY * nearY) > circle.z + margin) return QUAD_DISJOINT;
+        if (sqrtf(farX * farX + farY * farY) < circle.z - margin) return QUAD_CONTAINED;
+        return QUAD_STRADDLING;
+    }
+
+    /**
+     * @brief Fills a quad of the quadtree generator, subdividing it where a circle straddles it.
+     *
+     * @details The circles straddling the parent are classified against the quad: a contained one flips the parity
+     * of the whole quad, a disjoint one is dropped, and the straddling ones are handed to the children. A quad that
+     * no circle straddles and that lies inside or outside the disk is filled row by row with memset, only the quads
+     * of quadLeafSize texels on a boundary are tested texel by texel.
+     *
+     * @param textureWidth The width of the texture.
+     * @param x0 The first column of the quad.
+     * @param y0 The first row of the quad.
+     * @param x1 The column after the quad.
+     * @param y1 The row after the quad.
+     * @param parity The parity of the circles containing the parent.
+     * @param disk The coverage of the quad by the unit disk.
+     * @param first The first circle straddling the parent in stack.
+     * @param stack The straddling circles of the quads on the path from the root, every quad pushes its own.
+     * @param rows The classes of the band, starting with firstRow.
+     * @param firstRow The first row of the band.
+     */
+    static void renderQuad(int textureWidth, int x0, int y0, int x1, int y1, int parity, QuadCoverage disk,
+                           size_t first, std::vector<vec3> &stack, unsigned char *rows, int firstRow) {
+        float left = texelCoordinate(x0, textureWidth), right = texelCoordinate(x1 - 1, textureWidth);
+        float bottom = texelCoordinate(y0, textureWidth), top = texelCoordinate(y1 - 1, textureWidth);
+        if (disk == QUAD_STRADDLING) disk = quadCoverage(vec3(0, 0, 1), left, bottom, right, top);
+        size_t last = stack.size();
+        for (size_t i = first; i < last; i++) {
+            vec3 circle = stack[i]; // push_back may move the stack
+            QuadCoverage coverage = quadCoverage(circle, left, bottom, right, top);
+            if (coverage == QUAD_CONTAINED) parity ^= 1;
+            else if (coverage == QUAD_STRADDLING) stack.push_back(circle);
+        }
+        int width = x1 - x0, height = y1 - y0;
+        if (disk == QUAD_DISJOINT || (disk == QUAD_CONTAINED && stack.size() == last)) {
+            unsigned char texelClass = disk == QUAD_DISJOINT ? CLASS_OUTSIDE : parity ? CLASS_ODD : CLASS_EVEN;
+            for (int yC = y0; yC < y1; yC++) memset(rows + (size_t)(yC - firstRow) * textureWidth + x0, texelClass, width);
+        } else if (width <= quadLeafSize && height <= quadLeafSize) {
+            for (int yC = y0; yC < y1; yC++) {
+                float y = texelCoordinate(yC, textureWidth);
+                unsigned char *row = rows + (size_t)(yC - firstRow) * textureWidth;
+                for (int xC = x0; xC < x1; xC++) {
+                    if (disk != QUAD_CONTAINED && !texelInDisk(xC, y, textureWidth)) {
+                        row[xC] = CLASS_OUTSIDE;
+                        continue;
+                    }
+                    int texelParity = parity;
+                    for (size_t i = last; i < stack.size(); i++)
+                        texelParity ^= texelInCircle(xC, y, textureWidth, stack[i]) ? 1 : 0;
+                    row[xC] = texelParity ? CLASS_ODD : CLASS_EVEN;
+                }
+            }
+        } else { // split the long side of an elongated quad only, so that the children stay about square
+            int xMid = width > quadLeafSize && 2 * width >= height ? x0 + width / 2 : x1;
+            int yMid = height > quadLeafSize && 2 * height >= width ? y0 + height / 2 : y1;
+            renderQuad(textureWidth, x0, y0, xMid, yMid, parity, disk, last, stack, rows, firstRow);
+            if (xMid < x1) renderQuad(textureWidth, xMid, y0, x1, yMid, parity, disk, last, stack, rows, firstRow);
+            if (yMid < y1) renderQuad(textureWidth, x0, yMid, xMid, y1, parity, disk, last, stack, rows, firstRow);
+            if (xMid < x1 && yMid < y1)
+                renderQuad(textureWidth, xMid, yMid, x1, y1, parity, disk, last, stack, rows, firstRow);
+        }
+        stack.resize(last);
+    }
+
+    /**
+     * @brief Renders a band of rows of the texture by recursive subdivision into quads of constant parity.
+     *
+     * @details Most of the disk is made of large regions inside the same circles, which are filled in one go, and
+     * only the quads on a circle are subdivided, see renderQuad. A circle whose radius is below the texel spacing
+     * contains at most a few texel centres; it is kept out of the tree, and the texels of its box that pass the
+     * per-texel test have their parity flipped at the end. The result is the same as that of renderRows with the
+     * scalar parity test.
+     *
+     * @param textureWidth The width of the texture.
+     * @param firstRow The first row of the band.
+     * @param lastRow The row after the last row of the band.
+     * @param rows The classes of the band, starting with firstRow.
+     */
+    void renderQuadRows(int textureWidth, int firstRow, int lastRow, unsigned char *rows) const {
+        float spacing = 2.0f / (float)textureWidth;
+        float left = texelCoordinate(0, textureWidth), right = texelCoordinate(textureWidth - 1, textureWidth);
+        float bottom = texelCoordinate(firstRow, textureWidth), top = texelCoordinate(lastRow - 1, textureWidth);
+        std::vector<vec3> stack;
+        std::vector<int> flips;
+        int parity = 0;
+        for (const vec3 &circle : circles) {
+            QuadCoverage coverage = quadCoverage(circle, left, bottom, right, top);
+            if (coverage == QUAD_CONTAINED) parity ^= 1;
+            if (coverage != QUAD_STRADDLING) continue;
+            if (circle.z >= spacing) {
+                stack.push_back(circle);
+                continue;
+            }
+            int columnBegin = std::max(static_cast<int>((circle.x - circle.z + 1) / spacing) - 1, 0);
+            int columnEnd = std::min(static_cast<int>((circle.x + circle.z + 1) / spacing) + 2, textureWidth);
+            int rowBegin = std::max(static_cast<int>((circle.y - circle.z + 1) / spacing) - 1, firstRow);
+            int rowEnd = std::min(static_cast<int>((circle.y + circle.z + 1) / spacing) + 2, lastRow);
+            for (int yC = rowBegin; yC < rowEnd; yC++) {
+                float y = texelCoordinate(yC, textureWidth);
+                for (int xC = columnBegin; xC < columnEnd; xC++) {
+                    if (!texelInCircle(xC, y, textureWidth, circle)) continue;
+                    flips.push_back(xC);
+                    flips.push_back(yC);
+                }
+            }
+        }
+        stack.reserve(stack.size() * 2);
+        renderQuad(textureWidth, 0, firstRow, textureWidth, lastRow, parity, QUAD_STRADDLING, 0, stack, rows, firstRow);
+        for (size_t i = 0; i < flips.size(); i += 2) {
+            unsigned char &texel = rows[(size_t)(flips[i + 1] - firstRow) * textureWidth + flips[i]];
+            if (texel != CLASS_OUTSIDE) texel = texel == CLASS_EVEN ? CLASS_ODD : CLASS_EVEN;
+        }
+    }
+
+    /**
+     * @brief Renders a band of rows of a task of the worker pool with a CPU generator.
+     * @param textureWidth The width of the texture.
+     * @param firstRow The first row of the band.
+     * @param lastRow The row after the last row of the band.
+     * @param cpuGenerator GENERATOR_SPAN or GENERATOR_QUADTREE, the per-texel generator otherwise.
+     * @param rows The classes of the band, starting with firstRow.
+     */
+    void renderTaskRows(int textureWidth, int firstRow, int lastRow, TextureGenerator cpuGenerator, unsigned char *rows) {
+        TRACE_ZONE("PoincareGenerator::renderTaskRows");
+        if (cpuGenerator == GENERATOR_SPAN) renderSpanRows(textureWidth, firstRow, lastRow, rows);
+        else if (cpuGenerator == GENERATOR_QUADTREE) renderQuadRows(textureWidth, firstRow, lastRow, rows);
+        else renderRows(textureWidth, firstRow, lastRow, rows);
+    }
+
+    /**
+     * @brief Encodes a signed distance into a channel of the distance field.
+     * @param texels The distance in texels.
+     * @return 128 on the edge, 1 and 255 at -distanceRange and distanceRange and beyond.
+     */
+    static unsigned char encodeDistance(float texels) {
+        float scaled = texels / distanceRange;
+        scaled = scaled < -1 ? -1 : scaled > 1 ? 1 : scaled;
+        return static_cast<unsigned char>(lroundf(128 + 127 * scaled));
+    }
+
+    /**
+     * @brief Renders a band of rows of the texture as a two channel signed distance field.
+     *
+     * @details The first channel holds the distance to the nearest circle, positive where the parity is odd and
+     * negative where it is even. Every circle edge flips the parity, so the sign changes exactly where the distance
+     * is zero and the field is linear across an edge, which lets bilinear filtering place the edge between the
+     * texels. The second channel holds the distance to the rim of the disk, positive inside. The rows are split into
+     * chunks of distanceChunk texels, and only the circles that come within distanceRange of a chunk are tested for
+     * its texels, the others are too far to change the channels.
+     *
+     * @param textureWidth The width of the texture.
+     * @param firstRow The first row of the band.
+     * @param lastRow The row after the last row of the band.
+     * @param rows The texels of the band, two bytes each, starting with firstRow.
+     */
+    void renderDistanceRows(int textureWidth, int firstRow, int lastRow, unsigned char *rows) const {
+        TRACE_ZONE("PoincareGenerator::renderDistanceRows");
+        float texelsPerUnit = static_cast<float>(textureWidth) / 2;
+        float range = distanceRange / texelsPerUnit;
+        int chunkCount = (textureWidth + distanceChunk - 1) / distanceChunk;
+        std::vector<std::vector<vec3>> chunks(static_cast<size_t>(chunkCount));
+        for (int yC = firstRow; yC < lastRow; yC++) {
+            float y = (float) yC / (float)textureWidth * 2 - 1.0f;
+            for (std::vector<vec3> &chunk : chunks) chunk.clear();
+            for (const vec3 &circle : circles) { // the chunks the circle comes within range of
+                float reach = circle.z + range, dy = y - circle.y;
+                if (fabsf(dy) > reach) continue;
+                float halfWidth = sqrtf(reach * reach - dy * dy);
+                int first = static_cast<int>(floorf((circle.x - halfWidth + 1) * texelsPerUnit)) / distanceChunk;
+                int last = static_cast<int>(floorf((circle.x + halfWidth + 1) * texelsPerUnit)) / distanceChunk;
+                for (int chunk = std::max(first, 0); chunk <= std::min(last, chunkCount - 1); chunk++)
+                    chunks[static_cast<size_t>(chunk)].push_back(circle);
+            }
+            unsigned char *texel = rows + (size_t)(yC - firstRow) * textureWidth * 2;
+            for (int xC = 0; xC < textureWidth; xC++, texel += 2) {
+                float x = (float) xC / (float)textureWidth * 2 - 1.0f;
+                float nearest = range;
+                bool odd = false;
+                for (const vec3 &circle : chunks[static_cast<size_t>(xC / distanceChunk)]) {
+                    float edge = calculateDistance(vec2(x, y), circle) - circle.z;
+                    odd ^= edge <= 0; // the test of circleParity
+                    nearest = std::min(nearest, fabsf(edge));
+                }
+                texel[0] = encodeDistance((odd ? nearest : -nearest) * texelsPerUnit);
+                texel[1] = encodeDistance((1 - sqrtf(x * x + y * y)) * texelsPerUnit);
+            }
+        }
+    }
+
+    /**
+     * @brief Get the rows of a task of the worker pool.
+     * @param cpuGenerator The CPU generator.
+     * @return quadBandHeight for the quadtree generator, whose quads need some height, bandHeight otherwise.
+     */
+    static int taskHeight(TextureGenerator cpuGenerator) {
+        return cpuGenerator == GENERATOR_QUADTREE ? quadBandHeight : bandHeight;
+    }
+
+    /**
+    * @brief Renders the texture as one texel class per texel.
+    *
+    * @details The rows are split into bands which are rendered in parallel by the worker pool, per texel or, with the
+    * span generator, per run. Every texel is computed the same way as on a single thread, so the result does not
+    * depend on the thread count.
+    *
+    * @param textureWidth The width of the texture.
+    * @param textureHeight The height of the texture.
+    * @param cpuGenerator GENERATOR_SPAN or GENERATOR_QUADTREE, the per-texel generator otherwise.
+    * @return The texel classes, row by row.
+    */
+    std::vector<unsigned char> RenderClasses(int textureWidth, int textureHeight,
+                                             TextureGenerator cpuGenerator = GENERATOR_CPU) {
+        std::vector<unsigned char> classes;
+        renderClasses(textureWidth, textureHeight, cpuGenerator, classes, [] { return false; });
+        return classes;
+    }
+
+    /**
+     * @brief Renders the texture as texel classes with a CPU generator, stopping early if it gets cancelled.
+     * @param textureWidth The width of the texture.
+     * @param textureHeight The height of the texture.
+     * @param cpuGenerator GENERATOR_SPAN or GENERATOR_QUADTREE, the per-texel generator otherwise.
+     * @param classes The texel classes, row by row.
+     * @param cancelled Checked before every band, once it returns true the rendering stops.
+     * @return False if the rendering was cancelled and classes is incomplete.
+     */
+    bool renderClasses(int textureWidth, int textureHeight, TextureGenerator cpuGenerator,
+                       std::vector<unsigned char> &classes, const std::function<bool()> &cancelled) {
+        classes.assign((size_t)textureWidth * textureHeight, CLASS_OUTSIDE);
+        return renderBand(textureWidth, 0, textureHeight, cpuGenerator, classes.data(), cancelled);
+    }
+
+    /**
+     * @brief Renders a band of rows of the texture with a CPU generator, stopping early if it gets cancelled.
+     *
+     * @details The band is split into bands of bandHeight rows for the worker pool, so a part of a very large image
+     * can be rendered into a buffer that only holds that part, see CircleLimitExport.cpp.
+     *
+     * @param textureWidth The width of the texture.
+     * @param firstRow The first row of the band.
+     * @param lastRow The row after the last row of the band.
+     * @param cpuGenerator GENERATOR_SPAN or GENERATOR_QUADTREE, the per-texel generator otherwise.
+     * @param rows The classes of the band, starting with firstRow.
+     * @param cancelled Checked before every band of the pool, once it returns true the rendering stops.
+     * @return False if the rendering was cancelled and rows is incomplete.
+     */
+    bool renderBand(int textureWidth, int firstRow, int lastRow, TextureGenerator cpuGenerator, unsigned char *rows,
+                    const std::function<bool()> &cancelled) {
+        std::atomic<bool> stopped(false);
+        int taskRows = taskHeight(cpuGenerator);
+        int bandCount = (lastRow - firstRow + taskRows - 1) / taskRows;
+        pool->parallelFor(bandCount, [&](int band) {
+            if (stopped.load() || cancelled()) {
+                stopped = true;
+                return;
+            }
+            int first = firstRow + band * taskRows;
+            int last = std::min(first + taskRows, lastRow);
+            renderTaskRows(textureWidth, first, last, cpuGenerator, rows + (size_t)(first - firstRow) * textureWidth);
+        });
+        return !stopped.load();
+    }
+
+    /**
+     * @brief Renders the texture as a signed distance field, stopping early if it gets cancelled.
+     * @param textureWidth The width of the texture.
+     * @param textureHeight The height of the texture.
+     * @param texels The texels, two bytes each, see renderDistanceRows.
+     * @param cancelled Checked before every band, once it returns true the rendering stops.
+     * @return False if the rendering was cancelled and texels is incomplete.
+     */
+    bool renderDistanceField(int textureWidth, int textureHeight, std::vector<unsigned char> &texels,
+                             const std::function<bool()> &cancelled) {
+        texels.resize((size_t)textureWidth * textureHeight * 2);
+        std::atomic<bool> stopped(false);
+        pool->parallelFor((textureHeight + bandHeight - 1) / bandHeight, [&](int band) {
+            if (stopped.load() || cancelled()) {
+                stopped = true;
+                return;
+            }
+            int first = band * bandHeight;
+            int last = std::min(first + bandHeight, textureHeight);
+            renderDistanceRows(textureWidth, first, last, texels.data() + (size_t)first * textureWidth * 2);
+        });
+        return !stopped.load();
+    }
+
+    /**
+     * @brief Renders a band of rows of the texture with a CPU generator straight into texels of a layout.
+     *
+     * @details Every task of the worker pool renders its rows into classes of its own and writes their colours
+     * into texels, so no image of classes is kept, e.g. when texels is a mapped pixel unpack buffer.
+     *
+     * @param textureWidth The width of the texture.
+     * @param firstRow The first row of the band.
+     * @param lastRow The row after the last row of the band.
+     * @param cpuGenerator GENERATOR_SPAN or GENERATOR_QUADTREE, the per-texel generator otherwise.
+     * @param layout The layout of the texels.
+     * @param texels The texels of the band, tightly packed rows starting with firstRow.
+     * @param cancelled Checked before every band of the pool, once it returns true the rendering stops.
+     * @return False if the rendering was cancelled and texels is incomplete.
+     */
+    bool renderTexels(int textureWidth, int firstRow, int lastRow, TextureGenerator cpuGenerator, TexelLayout layout,
+                      unsigned char *texels, const std::function<bool()> &cancelled) {
+        if (layout == TEXELS_CLASSES) return renderBand(textureWidth, firstRow, lastRow, cpuGenerator, texels, cancelled);
+        unsigned char bytes[3][4];
+        for (int c = 0; c < 3; c++)
+            for (int i = 0; i < 4; i++) bytes[c][i] = static_cast<unsigned char>(classColor(c)[i] * 255);
+        size_t rowBytes = (size_t)textureWidth * texelBytes(layout);
+        std::atomic<bool> stopped(false);
+        int taskRows = taskHeight(cpuGenerator);
+        int bandCount = (lastRow - firstRow + taskRows - 1) / taskRows;
+        pool->parallelFor(bandCount, [&](int band) {
+            if (stopped.load() || cancelled()) {
+                stopped = true;
+                return;
+            }
+            int first = firstRow + band * taskRows;
+            int last = std::min(first + taskRows, lastRow);
+            std::vector<unsigned char> classes((size_t)(last - first) * textureWidth);
+            renderTaskRows(textureWidth, first, last, cpuGenerator, classes.data());
+            unsigned char *out = texels + (size_t)(first - firstRow) * rowBytes;
+            for (size_t i = 0; i < classes.size(); i++) memcpy(out + 4 * i, bytes[classes[i]], 4);
+        });
+        return !stopped.load();
+    }
+
+    /**
+     * @brief Anti-aliases rendered texel classes by supersampling only the texels on an edge.
+     *
+     * @details A texel whose eight neighbours all have its class keeps the colour of its single sample. The others lie
+     * on a circle or on the rim of the disk, they are sampled on a samples x samples grid spread over the texel around
+     * its sample point and get the mean colour. Features thinner than a texel that leave no disagreement between
+     * neighbours stay aliased, as in the single-sample texture.
+     *
+     * @param textureWidth The width of the texture.
+     * @param textureHeight The height of the texture.
+     * @param samples The number of subsamples along each axis of an edge texel.
+     * @param classes The texel classes rendered with one sample per texel.
+     * @param colors The anti-aliased colours, row by row.
+     * @param cancelled Checked before every band, once it returns true the anti-aliasing stops.
+     * @return False if the anti-aliasing was cancelled and colors is incomplete.
+     */
+    bool antialias(int textureWidth, int textureHeight, int samples, const std::vector<unsigned char> &classes,
+                   std::vector<vec4> &colors, const std::function<bool()> &cancelled) {
+        colors.resize(classes.size());
+        std::atomic<bool> stopped(false);
+        float weight = 1.0f / static_cast<float>(samples * samples);
+        pool->parallelFor((textureHeight + bandHeight - 1) / bandHeight, [&](int band) {
+            if (stopped.load() || cancelled()) {
+                stopped = true;
+                return;
+            }
+            TRACE_ZONE("PoincareGenerator::antialias band");
+            int lastRow = std::min((band + 1) * bandHeight, textureHeight);
+            for (int yC = band * bandHeight; yC < lastRow; yC++) {
+                const unsigned char *row = classes.data() + (size_t)yC * textureWidth;
+                const unsigned char *above = yC > 0 ? row - textureWidth : row;
+                const unsigned char *below = yC + 1 < textureHeight ? row + textureWidth : row;
+                vec4 *out = colors.data() + (size_t)yC * textureWidth;
+                for (int xC = 0; xC < textureWidth; xC++) {
+                    int left = xC > 0 ? xC - 1 : xC, right = xC + 1 < textureWidth ? xC + 1 : xC;
+                    unsigned char c = row[xC];
+                    bool uniform = true;
+                    for (int n = left; n <= right; n++) {
+                        if (above[n] != c || row[n] != c || below[n] != c) uniform = false;
+                    }
+                    if (uniform) {
+                        out[xC] = classColor(c);
+                        continue;
+                    }
+                    vec4 sum(0, 0, 0, 0);
+                    for (int j = 0; j < samples; j++) {
+                        float yS = ((float)yC + ((float)j + 0.5f) / (float)samples - 0.5f) / (float)textureWidth * 2 - 1;
+                        for (int i = 0; i < samples; i++) {
+                            float xS = ((float)xC + ((float)i + 0.5f) / (float)samples - 0.5f) / (float)textureWidth * 2 - 1;
+                            sum = sum + classColor(pointClass(xS, yS));
+                        }
+                    }
+                    out[xC] = sum * weight;
+                }
+            }
+        });
+        return !stopped.load();
+    }
+
+    /**
+    * @brief Renders the texture.
+    * @param textureWidth The width of the texture.
+    * @param textureHeight The height of the texture.
+    * @return The rendered texture.
+    */
+    std::vector<vec4> RenderToTexture(int textureWidth, int textureHeight) {
+        return classesToColors(RenderClasses(textureWidth, textureHeight));
+    }
+
+    /**
+    * @brief Renders the texture as 8-bit RGBA colours.
+    * @param textureWidth The width of the texture.
+    * @param textureHeight The height of the texture.
+    * @return The rendered texture, four bytes per texel.
+    */
+    std::vector<unsigned char> RenderToTexture8(int textureWidth, int textureHeight) {
+        return classesToColors8(RenderClasses(textureWidth, textureHeight));
+    }
+
+    /**
+     * @brief Converts texel classes to float colours.
+     * @param classes The texel classes.
+     * @return The colours of the texels.
+     */
+    static std::vector<vec4> classesToColors(const std::vector<unsigned char> &classes) {
+        std::vector<vec4> textureData;
+        textureData.reserve(classes.size());
+        for (unsigned char texelClass : classes) textureData.push_back(classColor(texelClass));
+        return textureData;
+    }
+
+    /**
+     * @brief Converts texel classes to 8-bit RGBA colours.
+     * @param classes The texel classes.
+     * @return The colours of the texels, four bytes per texel.
+     */
+    static std::vector<unsigned char> classesToColors8(const std::vector<unsigned char> &classes) {
+        std::vector<unsigned char> textureData(classes.size() * 4);
+        for (size_t i = 0; i < classes.size(); i++) {
+            vec4 color = classColor(classes[i]);
+            for (int c = 0; c < 4; c++) textureData[4 * i + c] = static_cast<unsigned char>(color[c] * 255);
+        }
+        return textureData;
+    }
+
+    /**
+     * @brief Converts float colours to 8-bit RGBA colours.
+     * @param colors The colours, every channel in [0, 1].
+     * @return The colours, four bytes per texel.
+     */
+    static std::vector<unsigned char> colorsToBytes(const std::vector<vec4> &colors) {
+        std::vector<unsigned char> textureData(colors.size() * 4);
+        for (size_t i = 0; i < colors.size(); i++) {
+            for (int c = 0; c < 4; c++) textureData[4 * i + c] = static_cast<unsigned char>(colors[i][c] * 255 + 0.5f);
+        }
+        return textureData;
+    }
+
+    /**
+     * @brief Computes the texels of the samples grid with the given step that no coarser grid has computed.
+     *
+     * @details Texel (xC, yC) belongs to the grid of step s if both coordinates are multiples of s. The grid of
+     * step 2s is contained in it, so in rows that are multiples of 2s only the odd multiples of s are new.
+     *
+     * @param textureWidth The width of the texture.
+     * @param textureHeight The height of the texture.
+     * @param step The step of the grid.
+     * @param first True for the coarsest grid, whose texels are all new.
+     * @param classes The classes of the whole texture, the new samples are overwritten.
+     */
+    void renderGridLevel(int textureWidth, int textureHeight, int step, bool first, unsigned char *classes) {
+        int rowCount = (textureHeight + step - 1) / step;
+        pool->parallelFor((rowCount + bandHeight - 1) / bandHeight, [&](int band) {
+            TRACE_ZONE("PoincareGenerator::renderGridLevel band");
+            int lastRow = std::min((band + 1) * bandHeight, rowCount);
+            for (int row = band * bandHeight; row < lastRow; row++) {
+                int yC = row * step;
+                bool coarseRow = !first && yC % (2 * step) == 0;
+                unsigned char *texels = classes + (size_t)yC * textureWidth;
+                for (int xC = coarseRow ? step : 0; xC < textureWidth; xC += coarseRow ? 2 * step : step) {
+                    texels[xC] = texelClass(xC, yC, textureWidth);
+                }
+            }
+        });
+    }
+};
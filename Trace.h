@@ -0,0 +1,255 @@
+//=============================================================================================
+// Trace: scoped zones recorded into per-thread rings and written as Chrome trace_event JSON
+//=============================================================================================
+#pragma once
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @struct TraceEvent
+ * @brief A finished zone in a TraceBuffer.
+ *
+ * @details The fields are atomics so that a dump may read a slot while its thread overwrites it, see TraceBuffer.
+ */
+struct TraceEvent {
+    std::atomic<const char *> name{nullptr}; ///< The name of the zone, a string literal.
+    std::atomic<int64_t> begin{0};           ///< The start of the zone in nanoseconds since the epoch of the recorder.
+    std::atomic<int64_t> duration{0};        ///< The duration of the zone in nanoseconds.
+};
+
+/**
+ * @class TraceBuffer
+ * @brief The ring of the events of one thread, written by that thread only and read by a dump without locking.
+ *
+ * @details Before overwriting a slot the thread raises claimed and issues a release fence, and after writing it it
+ * publishes the event by raising written. A reader loads written, copies the slots, issues an acquire fence and
+ * loads claimed: the slots that may have been overwritten in the meantime are the ones claimed again since, and
+ * are dropped. The slots are allocated by the first event, so threads that never record take no memory.
+ */
+class TraceBuffer {
+    std::unique_ptr<TraceEvent[]> events; ///< The slots, allocated by the first event of the thread.
+    std::atomic<uint64_t> claimed{0};     ///< The events whose slot has been written to, including one in progress.
+    std::atomic<uint64_t> written{0};     ///< The events recorded completely.
+
+public:
+    static const uint64_t capacity = 1 << 15; ///< The slots of the ring, older events are overwritten.
+    const int threadId;                       ///< The thread id of the events in the JSON file.
+    std::string threadName;                   ///< The name of the thread, guarded by the mutex of the recorder.
+
+    /**
+     * @brief Constructor.
+     * @param id The thread id of the events in the JSON file.
+     */
+    explicit TraceBuffer(int id) : threadId(id) {}
+
+    TraceBuffer(const TraceBuffer &) = delete;
+    TraceBuffer &operator=(const TraceBuffer &) = delete;
+
+    /**
+     * @brief Records a finished zone, only the owning thread may call it.
+     * @param name The name of the zone, a string literal.
+     * @param begin The start of the zone in nanoseconds.
+     * @param duration The duration of the zone in nanoseconds.
+     */
+    void record(const char *name, int64_t begin, int64_t duration) {
+        uint64_t index = written.load(std::memory_order_relaxed);
+        if (!events) events.reset(new TraceEvent[capacity]);
+        claimed.store(index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        TraceEvent &event = events[index % capacity];
+        event.name.store(name, std::memory_order_relaxed);
+        event.begin.store(begin, std::memory_order_relaxed);
+        event.duration.store(duration, std::memory_order_relaxed);
+        written.store(index + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Calls a function for every event still in the ring and not overwritten while it is read.
+     * @param visit Called with the name, the start and the duration of every event, oldest first.
+     */
+    template<typename Visitor>
+    void forEach(Visitor visit) const {
+        uint64_t end = written.load(std::memory_order_acquire);
+        if (end == 0) return;
+        uint64_t first = end > capacity ? end - capacity : 0;
+        struct Copy { const char *name; int64_t begin, duration; };
+        std::vector<Copy> copies;
+        copies.reserve(static_cast<size_t>(end - first));
+        for (uint64_t index = first; index < end; index++) {
+            const TraceEvent &event = events[index % capacity];
+            copies.push_back({event.name.load(std::memory_order_relaxed), event.begin.load(std::memory_order_relaxed),
+                              event.duration.load(std::memory_order_relaxed)});
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t reclaimed = claimed.load(std::memory_order_relaxed);
+        for (uint64_t index = first; index < end; index++) {
+            if (index + capacity < reclaimed) continue; // the slot has been claimed by a newer event
+            const Copy &copy = copies[static_cast<size_t>(index - first)];
+            visit(copy.name, copy.begin, copy.duration);
+        }
+    }
+};
+
+/**
+ * @class TraceRecorder
+ * @brief Collects the trace zones of all threads while tracing is enabled and writes them as Chrome JSON.
+ *
+ * @details Every thread gets a TraceBuffer of its own on its first zone, so recording takes no lock, and the
+ * buffers live until the process exits. While tracing is off a zone only loads the enabled flag. The JSON file
+ * holds the events of the current session in the trace_event format of chrome://tracing and Perfetto, with one
+ * track per thread.
+ */
+class TraceRecorder {
+    std::mutex mutex;                                  ///< Guards buffers and the names of the threads.
+    std::vector<std::unique_ptr<TraceBuffer>> buffers; ///< The rings of the threads that have recorded or been named.
+    std::chrono::steady_clock::time_point epoch;       ///< The time the event times are relative to.
+    std::atomic<int64_t> sessionStart{0};              ///< The time tracing was last enabled at, in nanoseconds.
+
+    /**
+     * @brief Constructor, sets the epoch.
+     */
+    TraceRecorder() : epoch(std::chrono::steady_clock::now()) {}
+
+public:
+    std::atomic<bool> enabled{false}; ///< Zones are being recorded.
+
+    TraceRecorder(const TraceRecorder &) = delete;
+    TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+    /**
+     * @brief Get the recorder of the process.
+     *
+     * @details It is never destroyed, so threads that outlive the static objects of the program can still end zones.
+     *
+     * @return The recorder.
+     */
+    static TraceRecorder &instance() {
+        static TraceRecorder *recorder = new TraceRecorder();
+        return *recorder;
+    }
+
+    /**
+     * @brief Get the current time.
+     * @return The time since the epoch in nanoseconds.
+     */
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    /**
+     * @brief Get the ring of the calling thread, creating it on first use.
+     * @return The ring.
+     */
+    TraceBuffer &threadBuffer() {
+        thread_local TraceBuffer *buffer = nullptr;
+        if (buffer) return *buffer;
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers.emplace_back(new TraceBuffer(static_cast<int>(buffers.size()) + 1));
+        buffer = buffers.back().get();
+        return *buffer;
+    }
+
+    /**
+     * @brief Names the track of the calling thread.
+     * @param name The name, e.g. "main" or "worker 3".
+     */
+    void nameThread(const std::string &name) {
+        TraceBuffer &buffer = threadBuffer();
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer.threadName = name;
+    }
+
+    /**
+     * @brief Starts a session, the JSON file only holds the events recorded from now on.
+     */
+    void start() {
+        sessionStart = now();
+        enabled = true;
+    }
+
+    /**
+     * @brief Stops recording, the events of the session stay in the rings until they are overwritten.
+     */
+    void stop() { enabled = false; }
+
+    /**
+     * @brief Writes the events of the current session in the Chrome trace_event JSON format.
+     * @param fileName The name of the file.
+     * @return The number of events written, or -1 if the file cannot be written.
+     */
+    long write(const std::string &fileName) {
+        FILE *file = fopen(fileName.c_str(), "w");
+        if (!file) {
+            printf("Cannot open %s\n", fileName.c_str());
+            return -1;
+        }
+        int64_t since = sessionStart.load();
+        long count = 0;
+        const char *separator = "\n";
+        fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const std::unique_ptr<TraceBuffer> &buffer : buffers) {
+            std::string name = buffer->threadName.empty() ? "thread " + std::to_string(buffer->threadId) : buffer->threadName;
+            fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                    separator, buffer->threadId, name.c_str());
+            separator = ",\n";
+            buffer->forEach([&](const char *zone, int64_t begin, int64_t duration) {
+                if (begin < since) return;
+                fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                        zone, buffer->threadId, static_cast<double>(begin) / 1000, static_cast<double>(duration) / 1000);
+                count++;
+            });
+        }
+        fprintf(file, "\n]}\n");
+        bool written = fclose(file) == 0;
+        return written ? count : -1;
+    }
+};
+
+/**
+ * @class TraceZone
+ * @brief Records the time from its construction to its destruction as a zone, use it through TRACE_ZONE.
+ */
+class TraceZone {
+    const char *name; ///< The name of the zone, nullptr if tracing was off when the zone started.
+    int64_t begin;    ///< The start of the zone in nanoseconds.
+
+public:
+    /**
+     * @brief Starts the zone if tracing is enabled.
+     * @param zoneName The name of the zone, a string literal.
+     */
+    explicit TraceZone(const char *zoneName) : name(nullptr), begin(0) {
+        TraceRecorder &recorder = TraceRecorder::instance();
+        if (!recorder.enabled.load(std::memory_order_relaxed)) return;
+        name = zoneName;
+        begin = recorder.now();
+    }
+
+    TraceZone(const TraceZone &) = delete;
+    TraceZone &operator=(const TraceZone &) = delete;
+
+    /**
+     * @brief Ends the zone and records it into the ring of the thread.
+     */
+    ~TraceZone() {
+        if (!name) return;
+        TraceRecorder &recorder = TraceRecorder::instance();
+        recorder.threadBuffer().record(name, begin, recorder.now() - begin);
+    }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#if defined(FRAMEWORK_NO_TRACE)
+#define TRACE_ZONE(name)
+#else
+/// Records the rest of the enclosing scope as a zone of the given name, a string literal.
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#endif
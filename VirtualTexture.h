@@ -0,0 +1,526 @@
+//=============================================================================================
+// VirtualTexture: the Poincare disk as a pyramid of tiles that are generated on demand for deep zoom
+//=============================================================================================
+#pragma once
+#include "framework.h"
+#include "PoincareGenerator.h"
+#include "PerformanceHud.h"
+#include <list>
+#include <unordered_map>
+
+/**
+ * @brief Finds the part of a textured triangle fan that the camera sees.
+ *
+ * @details Every triangle of the fan is clipped against the view rectangle, and the corners of the visible part
+ * are mapped to texture coordinates with the affine map of the triangle. The detail the view needs follows from
+ * the same map: a step of one texture unit along the direction the triangle stretches most.
+ *
+ * @param positions The vertices of the fan in world coordinates, the first one is the centre.
+ * @param uvs The texture coordinates of the vertices.
+ * @param count The number of vertices.
+ * @param viewMin The lower left corner of the view in world coordinates.
+ * @param viewMax The upper right corner of the view in world coordinates.
+ * @param uvMin The lower left corner of the bounding box of the visible texture coordinates.
+ * @param uvMax The upper right corner of the bounding box of the visible texture coordinates.
+ * @param worldPerUv The largest world distance of a unit step in texture coordinates over the visible triangles.
+ * @return False if no part of the fan is in the view.
+ */
+inline bool visibleFanBounds(const vec2 *positions, const vec2 *uvs, int count, vec2 viewMin, vec2 viewMax,
+                             vec2 &uvMin, vec2 &uvMax, float &worldPerUv) {
+    auto cross2 = [](vec2 u, vec2 v) { return u.x * v.y - u.y * v.x; };
+    uvMin = vec2(1, 1);
+    uvMax = vec2(0, 0);
+    worldPerUv = 0;
+    bool visible = false;
+    std::vector<vec2> polygon, clipped;
+    for (int i = 1; i + 1 < count; i++) {
+        vec2 p0 = positions[0], e1 = positions[i] - p0, e2 = positions[i + 1] - p0;
+        float det = cross2(e1, e2);
+        if (fabsf(det) < 1e-12f) continue;
+        polygon = {positions[0], positions[i], positions[i + 1]};
+        for (int side = 0; side < 4 && !polygon.empty(); side++) { // Sutherland-Hodgman against the four sides
+            int axis = side / 2;
+            bool lower = side % 2 == 0;
+            float bound = axis == 0 ? (lower ? viewMin.x : viewMax.x) : (lower ? viewMin.y : viewMax.y);
+            auto coordinate = [&](vec2 p) { return axis == 0 ? p.x : p.y; };
+            auto inside = [&](vec2 p) { return lower ? coordinate(p) >= bound : coordinate(p) <= bound; };
+            clipped.clear();
+            for (size_t k = 0; k < polygon.size(); k++) {
+                vec2 a = polygon[k], b = polygon[(k + 1) % polygon.size()];
+                if (inside(a)) clipped.push_back(a);
+                if (inside(a) != inside(b))
+                    clipped.push_back(a + (b - a) * ((bound - coordinate(a)) / (coordinate(b) - coordinate(a))));
+            }
+            polygon.swap(clipped);
+        }
+        if (polygon.empty()) continue;
+        visible = true;
+
+        vec2 du1 = uvs[i] - uvs[0], du2 = uvs[i + 1] - uvs[0];
+        for (const vec2 &p : polygon) { // p = p0 + s e1 + t e2
+            float s = cross2(p - p0, e2) / det, t = cross2(e1, p - p0) / det;
+            vec2 uv = uvs[0] + du1 * s + du2 * t;
+            uvMin = vec2(std::min(uvMin.x, uv.x), std::min(uvMin.y, uv.y));
+            uvMax = vec2(std::max(uvMax.x, uv.x), std::max(uvMax.y, uv.y));
+        }
+        // the Jacobian of world -> uv, a unit uv step is longest along its smallest singular value
+        float j00 = (du1.x * e2.y - du2.x * e1.y) / det, j01 = (du2.x * e1.x - du1.x * e2.x) / det;
+        float j10 = (du1.y * e2.y - du2.y * e1.y) / det, j11 = (du2.y * e1.x - du1.y * e2.x) / det;
+        float frobenius = j00 * j00 + j01 * j01 + j10 * j10 + j11 * j11, jacobian = fabsf(j00 * j11 - j01 * j10);
+        float largest = sqrtf(0.5f * (frobenius + sqrtf(std::max(frobenius * frobenius - 4 * jacobian * jacobian, 0.0f))));
+        if (jacobian > 0) worldPerUv = std::max(worldPerUv, largest / jacobian);
+    }
+    uvMin = vec2(std::max(uvMin.x, 0.0f), std::max(uvMin.y, 0.0f));
+    uvMax = vec2(std::min(uvMax.x, 1.0f), std::min(uvMax.y, 1.0f));
+    return visible;
+}
+
+/**
+ * @struct TileKey
+ * @brief A tile of the pyramid: level l splits the texture coordinates [0, 1]^2 into 2^l x 2^l tiles.
+ */
+struct TileKey {
+    int level; ///< The level of the tile, 0 for the single tile covering the whole disk.
+    int x;     ///< The column of the tile on its level.
+    int y;     ///< The row of the tile on its level.
+
+    /**
+     * @brief Constructor.
+     */
+    TileKey(int level = 0, int x = 0, int y = 0) : level(level), x(x), y(y) {}
+
+    /**
+     * @brief Compare two keys.
+     * @param key The other key.
+     * @return True if both keys describe the same tile.
+     */
+    bool operator==(const TileKey &key) const { return level == key.level && x == key.x && y == key.y; }
+
+    /**
+     * @brief Get a unique number of the tile, the levels have at most 2^24 tiles per axis.
+     * @return The number.
+     */
+    uint64_t id() const { return (uint64_t)level << 48 | (uint64_t)x << 24 | (uint64_t)y; }
+
+    /**
+     * @brief Get the tile of the next coarser level that contains this one.
+     * @return The parent tile, only valid for level > 0.
+     */
+    TileKey parent() const { return TileKey(level - 1, x / 2, y / 2); }
+};
+
+/**
+ * @class VirtualTexture
+ * @brief The tiling as a virtual texture: a tile pyramid of which only the tiles the camera sees are generated.
+ *
+ * @details Level l of the pyramid renders the disk at 256 * 2^l texels across, split into tiles of 256 x 256
+ * texels. Every frame, update picks the level whose texels are about as large as the pixels, requests the visible
+ * tiles of it that are missing and fills the page table. A background thread renders the requested tiles with the
+ * span generator, nearest to the middle of the view first; only the circles that reach into a tile are
+ * intersected, so a tile of a deep level costs about as much as one of level 0.
+ *
+ * The generated tiles are kept in the slots of an atlas and reused in least-recently-used order, the level 0 tile
+ * stays in slot 0 for good. Each tile has a border of one texel, so the atlas can be filtered bilinearly. The page
+ * table is a small float texture with one texel per visible tile of the level, holding the scale and offset that
+ * map the texture coordinates into the atlas slot of that tile, or of the finest resident tile above it, so a
+ * coarser parent is shown until the finer tile arrives.
+ *
+ * The texture coordinates are floats, so the pyramid stops at maxLevel, where the float step of the coordinates
+ * near 1 is still about 1/16 of a texel.
+ */
+class VirtualTexture {
+public:
+    static const int tileSize = 256;                      ///< The texels of a tile along each axis, without the border.
+    static const int slotSize = tileSize + 2;             ///< The texels of an atlas slot along each axis.
+    static const int atlasColumns = 8;                    ///< The slots along each axis of the atlas.
+    static const int atlasSize = atlasColumns * slotSize; ///< The texels of the atlas along each axis.
+    static const int pageSize = 16;                       ///< The texels of the page table along each axis.
+    static const int maxLevel = 12;                       ///< The finest level of the pyramid.
+    static const int uploadsPerFrame = 8;                 ///< The most finished tiles uploaded in one frame.
+
+private:
+    /**
+     * @struct ResidentTile
+     * @brief A tile in a slot of the atlas.
+     */
+    struct ResidentTile {
+        TileKey key;                         ///< The tile.
+        int slot;                            ///< The slot of the atlas holding the tile.
+        unsigned long lastUsed;              ///< The frame that last showed the tile.
+        std::list<uint64_t>::iterator lru;   ///< The place of the tile in lru, unused for the level 0 tile.
+    };
+
+    /**
+     * @struct FinishedTile
+     * @brief A tile rendered by the background thread that is not uploaded yet.
+     */
+    struct FinishedTile {
+        TileKey key;                       ///< The tile.
+        std::vector<unsigned char> texels; ///< The RGBA8 texels of the slot, border included.
+    };
+
+    PoincareGenerator generator;                         ///< The circles of the tiling and the span generator.
+    Texture atlas;                                       ///< The slots of the resident tiles.
+    Texture pageTable;                                   ///< The atlas mapping of the visible tiles, RGBA32F.
+    std::unordered_map<uint64_t, ResidentTile> resident; ///< The tiles in the atlas by TileKey::id.
+    std::list<uint64_t> lru;                             ///< The evictable resident tiles, the most recently used first.
+    std::vector<int> freeSlots;                          ///< The slots of the atlas not holding a tile.
+    std::vector<vec4> pageEntries;                       ///< The texels of the page table.
+    std::vector<vec4> uploadedEntries;                   ///< The texels of the page table on the GPU.
+    int level = 0;                                       ///< The level of the page table.
+    int pageX = 0, pageY = 0;                            ///< The tile of the level in the first texel of the page table.
+    unsigned long frame = 0;                             ///< The number of updates so far.
+    int visibleTiles = 0;                                ///< The tiles of the level in the view.
+    int fallbackTiles = 0;                               ///< The visible tiles shown with a coarser tile.
+    unsigned long evictions = 0;                         ///< The tiles dropped from the atlas to make room.
+    std::thread worker;                                  ///< Renders the requested tiles, started on first use.
+    std::mutex mutex;                                    ///< Guards the requests and the finished tiles.
+    std::condition_variable wakeUp;                      ///< Signals the worker a new request or stopping.
+    std::vector<TileKey> wanted;                         ///< The requested tiles, the most urgent first.
+    bool working = false;                                ///< The worker is rendering a tile.
+    TileKey workingKey;                                  ///< The tile the worker is rendering.
+    std::vector<FinishedTile> finished;                  ///< The rendered tiles waiting for their upload.
+    bool stopping = false;                               ///< Tells the worker to exit.
+    unsigned long generatedTiles = 0;                    ///< The tiles rendered by the worker.
+    double lastTileMs = 0;                               ///< The time the worker took for the last tile.
+
+    /**
+     * @brief Renders a tile with its border into RGBA8 texels.
+     *
+     * @details Texel k of the slot is texel 256 x - 1 + k of the level, and texel X of a level of N texels across
+     * holds the point 2 X / N - 1, as in PoincareGenerator::texelClass.
+     *
+     * @param key The tile.
+     * @param texels The texels of the slot, row by row.
+     */
+    void renderTile(const TileKey &key, std::vector<unsigned char> &texels) const {
+        TRACE_ZONE("VirtualTexture::renderTile");
+        std::vector<unsigned char> classes((size_t)slotSize * slotSize);
+        generator.renderSpanWindow(tileSize << key.level, key.x * tileSize - 1, key.y * tileSize - 1, slotSize, slotSize,
+                                   classes.data());
+        texels = PoincareGenerator::classesToColors8(classes);
+    }
+
+    /**
+     * @brief Uploads the texels of a tile into a slot and makes the tile resident.
+     * @param key The tile.
+     * @param slot The slot.
+     * @param texels The texels of the slot, row by row.
+     */
+    void place(const TileKey &key, int slot, const std::vector<unsigned char> &texels) {
+        atlas.update(slot % atlasColumns * slotSize, slot / atlasColumns * slotSize, slotSize, slotSize, texels.data());
+        ResidentTile tile{key, slot, 0, lru.end()};
+        if (key.level > 0) tile.lru = lru.insert(lru.begin(), key.id());
+        resident[key.id()] = tile;
+    }
+
+    /**
+     * @brief Finds a slot for a new tile, evicting the least recently used tile if the atlas is full.
+     *
+     * @details Tiles shown in this or the previous frame are not evicted.
+     *
+     * @return The slot, or -1 if every slot holds a tile that is in use.
+     */
+    int allocateSlot() {
+        if (!freeSlots.empty()) {
+            int slot = freeSlots.back();
+            freeSlots.pop_back();
+            return slot;
+        }
+        for (auto it = lru.rbegin(); it != lru.rend(); ++it) {
+            auto tile = resident.find(*it);
+            if (tile->second.lastUsed + 1 >= frame) continue;
+            int slot = tile->second.slot;
+            lru.erase(tile->second.lru);
+            resident.erase(tile);
+            evictions++;
+            return slot;
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Marks a resident tile as shown in this frame.
+     * @param tile The tile.
+     */
+    void touch(ResidentTile &tile) {
+        tile.lastUsed = frame;
+        if (tile.key.level > 0) lru.splice(lru.begin(), lru, tile.lru);
+    }
+
+    /**
+     * @brief Get the page table texel of a resident tile.
+     *
+     * @details The atlas coordinate of the texture coordinate uv is uv * scale + offset with scale = 2^l * 256 / A
+     * and offset = (slot corner + 1 - 256 (x, y)) / A for a tile (l, x, y) in an atlas of A texels across.
+     *
+     * @param tile The tile.
+     * @return The scale, the offset and the level of the tile.
+     */
+    static vec4 pageEntry(const ResidentTile &tile) {
+        float atlasTexels = static_cast<float>(atlasSize);
+        float scale = static_cast<float>(tileSize << tile.key.level) / atlasTexels;
+        float offsetX = static_cast<float>(tile.slot % atlasColumns * slotSize + 1 - tile.key.x * tileSize) / atlasTexels;
+        float offsetY = static_cast<float>(tile.slot / atlasColumns * slotSize + 1 - tile.key.y * tileSize) / atlasTexels;
+        return vec4(scale, offsetX, offsetY, static_cast<float>(tile.key.level));
+    }
+
+    /**
+     * @brief Uploads up to uploadsPerFrame tiles finished by the worker.
+     */
+    void uploadFinished() {
+        std::vector<FinishedTile> tiles;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t count = std::min(finished.size(), static_cast<size_t>(uploadsPerFrame));
+            for (size_t i = 0; i < count; i++) tiles.push_back(std::move(finished[i]));
+            finished.erase(finished.begin(), finished.begin() + count);
+        }
+        for (const FinishedTile &tile : tiles) {
+            if (resident.count(tile.key.id())) continue;
+            int slot = allocateSlot();
+            if (slot < 0) continue; // it is requested again if it is still visible
+            place(tile.key, slot, tile.texels);
+        }
+    }
+
+    /**
+     * @brief Empties the atlas and renders the level 0 tile into slot 0, the worker must not be running.
+     */
+    void reset() {
+        resident.clear();
+        lru.clear();
+        freeSlots.clear();
+        for (int slot = atlasColumns * atlasColumns - 1; slot > 0; slot--) freeSlots.push_back(slot);
+        std::vector<unsigned char> texels;
+        renderTile(TileKey(), texels);
+        place(TileKey(), 0, texels);
+        uploadedEntries.clear();
+    }
+
+    /**
+     * @brief Stops and joins the worker, the requests and finished tiles are dropped.
+     */
+    void stopWorker() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeUp.notify_one();
+        if (worker.joinable()) worker.join();
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = false;
+        wanted.clear();
+        finished.clear();
+    }
+
+    /**
+     * @brief The main loop of the worker, it renders the most urgent request.
+     */
+    void workerLoop() {
+        TraceRecorder::instance().nameThread("virtual texture tiles");
+        while (true) {
+            TileKey key;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeUp.wait(lock, [&] { return stopping || !wanted.empty(); });
+                if (stopping) return;
+                key = wanted.front();
+                wanted.erase(wanted.begin());
+                working = true;
+                workingKey = key;
+            }
+            FinishedTile tile;
+            tile.key = key;
+            double start = timestampMs();
+            renderTile(key, tile.texels);
+            std::lock_guard<std::mutex> lock(mutex);
+            working = false;
+            finished.push_back(std::move(tile));
+            generatedTiles++;
+            lastTileMs = timestampMs() - start;
+        }
+    }
+
+public:
+    /**
+     * @brief Constructor, allocates the atlas and renders the level 0 tile.
+     * @param pool The worker pool of the generator, the tiles themselves are rendered on one thread.
+     * @param spec The tiling.
+     */
+    VirtualTexture(WorkerPool &pool, const TilingSpec &spec) : generator(pool, spec),
+                                                               pageEntries(pageSize * pageSize) {
+        atlas.allocate(atlasSize, atlasSize, GL_RGBA8);
+        atlas.setFiltering(GL_LINEAR, GL_LINEAR);
+        pageTable.allocate(pageSize, pageSize, GL_RGBA32F);
+        pageTable.setFiltering(GL_NEAREST, GL_NEAREST);
+        reset();
+    }
+
+    VirtualTexture(const VirtualTexture &) = delete;
+    VirtualTexture &operator=(const VirtualTexture &) = delete;
+
+    /**
+     * @brief Destructor, stops the worker.
+     */
+    ~VirtualTexture() { stopWorker(); }
+
+    /**
+     * @brief Selects the tiling, the atlas is emptied and the level 0 tile rendered again.
+     * @param spec The tiling.
+     */
+    void setTiling(const TilingSpec &spec) {
+        stopWorker();
+        generator.setTiling(spec);
+        reset();
+    }
+
+    /**
+     * @brief Uploads finished tiles, requests the missing visible ones and fills the page table, once per frame.
+     *
+     * @details The level is the coarsest one with at least one texel per pixel, made coarser while the visible
+     * tiles do not fit into the page table or into half of the atlas, which leaves room for their parents.
+     *
+     * @param uvMin The lower left corner of the visible texture coordinates.
+     * @param uvMax The upper right corner of the visible texture coordinates, less than uvMin if nothing is visible.
+     * @param pixelsPerUv The pixels of a unit step in texture coordinates, along the direction it is longest.
+     */
+    void update(vec2 uvMin, vec2 uvMax, float pixelsPerUv) {
+        frame++;
+        uploadFinished();
+        vec4 rootEntry = pageEntry(resident.at(TileKey().id()));
+        std::fill(pageEntries.begin(), pageEntries.end(), rootEntry);
+        std::vector<TileKey> missing;
+        visibleTiles = fallbackTiles = 0;
+        level = 0;
+        pageX = pageY = 0;
+        if (uvMin.x <= uvMax.x && uvMin.y <= uvMax.y) {
+            float tiles = pixelsPerUv / tileSize;
+            level = tiles > 1 ? static_cast<int>(ceilf(log2f(tiles))) : 0;
+            if (level > maxLevel) level = maxLevel;
+            int x1, y1;
+            for (;; level--) {
+                int last = (1 << level) - 1;
+                pageX = std::min(std::max(static_cast<int>(floorf(uvMin.x * (float)(1 << level))), 0), last);
+                pageY = std::min(std::max(static_cast<int>(floorf(uvMin.y * (float)(1 << level))), 0), last);
+                x1 = std::min(std::max(static_cast<int>(floorf(uvMax.x * (float)(1 << level))), 0), last);
+                y1 = std::min(std::max(static_cast<int>(floorf(uvMax.y * (float)(1 << level))), 0), last);
+                int columns = x1 - pageX + 1, rows = y1 - pageY + 1;
+                if (level == 0 || (columns <= pageSize && rows <= pageSize &&
+                                   columns * rows <= atlasColumns * atlasColumns / 2)) break;
+            }
+            for (int y = pageY; y <= y1; y++) {
+                for (int x = pageX; x <= x1; x++) {
+                    TileKey key(level, x, y);
+                    auto tile = resident.find(key.id());
+                    visibleTiles++;
+                    if (tile == resident.end()) {
+                        missing.push_back(key);
+                        fallbackTiles++;
+                        while (tile == resident.end()) { // the level 0 tile is always resident
+                            key = key.parent();
+                            tile = resident.find(key.id());
+                        }
+                    }
+                    touch(tile->second);
+                    pageEntries[(y - pageY) * pageSize + (x - pageX)] = pageEntry(tile->second);
+                }
+            }
+            float middleX = 0.5f * (float)(pageX + x1), middleY = 0.5f * (float)(pageY + y1);
+            std::sort(missing.begin(), missing.end(), [&](const TileKey &a, const TileKey &b) {
+                return fabsf(a.x - middleX) + fabsf(a.y - middleY) < fabsf(b.x - middleX) + fabsf(b.y - middleY);
+            });
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            wanted.clear();
+            for (const TileKey &key : missing) {
+                bool underway = working && workingKey == key;
+                for (const FinishedTile &tile : finished) underway = underway || tile.key == key;
+                if (!underway) wanted.push_back(key);
+            }
+            if (!wanted.empty() && !worker.joinable()) worker = std::thread(&VirtualTexture::workerLoop, this);
+        }
+        wakeUp.notify_one();
+
+        if (uploadedEntries.size() != pageEntries.size() ||
+            memcmp(uploadedEntries.data(), pageEntries.data(), pageEntries.size() * sizeof(vec4)) != 0) {
+            pageTable.update(0, 0, pageSize, pageSize, pageEntries.data());
+            uploadedEntries = pageEntries;
+        }
+    }
+
+    /**
+     * @brief Binds the atlas and the page table and sets the uniforms of virtualFragmentSource.
+     * @param program The virtual texture GPU program, it must be in use.
+     * @param pageUnit The texture unit to bind the page table to, the atlas goes to unit 0.
+     */
+    void bind(GPUProgram &program, unsigned int pageUnit) {
+        glActiveTexture(GL_TEXTURE0 + pageUnit);
+        glBindTexture(GL_TEXTURE_2D, pageTable.textureId);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, atlas.textureId);
+        program.setUniform(0, "atlas");
+        program.setUniform(static_cast<int>(pageUnit), "pageTable");
+        program.setUniform(level, "pageLevel");
+        program.setUniform(vec2(static_cast<float>(pageX), static_cast<float>(pageY)), "pageOrigin");
+        program.setUniform(pageEntry(resident.at(TileKey().id())), "rootEntry");
+    }
+
+    /**
+     * @brief Checks whether tiles are still being rendered or uploaded.
+     * @return True if another frame would show more detail.
+     */
+    bool busy() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return working || !wanted.empty() || !finished.empty();
+    }
+
+    /**
+     * @brief Get the level of the page table.
+     * @return The level of the last update.
+     */
+    int getLevel() const { return level; }
+
+    /**
+     * @brief Get the number of tiles in the atlas.
+     * @return The resident tiles, the level 0 tile included.
+     */
+    int residentCount() const { return static_cast<int>(resident.size()); }
+
+    /**
+     * @brief Get the number of visible tiles of the level of the last update.
+     * @return The visible tiles.
+     */
+    int getVisibleTiles() const { return visibleTiles; }
+
+    /**
+     * @brief Get the number of visible tiles shown with a coarser tile in the last update.
+     * @return The visible tiles that are not resident.
+     */
+    int getFallbackTiles() const { return fallbackTiles; }
+
+    /**
+     * @brief Get the number of tiles evicted from the atlas.
+     * @return The evictions so far.
+     */
+    unsigned long getEvictions() const { return evictions; }
+
+    /**
+     * @brief Get the number of tiles rendered and the time of the last one.
+     * @param ms The time the worker took for the last tile in milliseconds.
+     * @return The tiles rendered so far.
+     */
+    unsigned long getGeneratedTiles(double &ms) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ms = lastTileMs;
+        return generatedTiles;
+    }
+
+    /**
+     * @brief Get the GPU memory of the atlas and the page table.
+     * @return The memory in bytes.
+     */
+    size_t residentBytes() const { return atlas.info.bytes() + pageTable.info.bytes(); }
+};